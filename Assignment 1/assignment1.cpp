@@ -1,90 +1,1032 @@
 #include <iostream>
-#include <iostream>
 #include <vector>
+#include <string>
+#include <string_view>
+#include <cstdint>
 #include <fstream>
 #include <unordered_map>
 #include <filesystem>
 #include <algorithm>
+#include <memory>
+#include <memory_resource>
+#include <cstring>
+#include <cmath>
+#include <stdexcept>
+#include <thread>
+#include <chrono>
+#include <queue>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "../common/token_stream.h"
+#include "../common/scratch_arena.h"
+#include "../common/parallel_for.h"
+#include "../common/name_index.h"
+#include "../common/bench_report.h"
 
 using namespace std;
 namespace fs = filesystem;
 
-struct Document{
-    string doc_name;
-    vector<int> word_position;
+// Lowercase whitespace-separated words
+using TokenStream = BasicTokenStream<TokenRule::Whitespace>;
+
+// Every posting of a term lives in one contiguous byte block:
+//   [docGap, termFrequency, posGap_1 ... posGap_tf] per document,
+// with every number variable-byte encoded and gaps taken from the previous value.
+// Documents are referred to by their id in the document table instead of by path.
+struct TermEntry{
+    uint32_t term_offset;       // where the term starts in the term pool
+    uint32_t term_length;
+    uint64_t postings_offset;   // where the postings block starts in the postings section
+    uint32_t postings_length;
+    uint32_t doc_frequency;
+};
+
+// The index is a single image that is either built in memory or mapped from an
+// index file. Sections are 8-byte aligned and addressed by their offset from the
+// start of the image, so a mapped file is queried in place without any parsing.
+const char INDEX_MAGIC[8] = {'I', 'R', 'P', 'O', 'S', 'I', 'D', 'X'};
+const uint32_t INDEX_VERSION = 1;
+
+struct IndexHeader{
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t file_size;
+    uint64_t checksum;          // FNV-1a over everything after the header
+    uint64_t token_count;
+    uint32_t doc_count;
+    uint32_t term_count;
+    uint64_t doc_offsets;       // uint32_t[doc_count + 1] into the document pool
+    uint64_t doc_pool;          // document paths back to back
+    uint64_t doc_lengths;       // uint32_t[doc_count], tokens per document
+    uint64_t doc_norms;         // float[doc_count], sqrt of the sum of squared tfs
+    uint64_t terms;             // TermEntry[term_count], sorted by term
+    uint64_t term_pool;         // terms back to back, in sorted order
+    uint64_t postings;
+};
+
+struct PositionalIndex{
+    shared_ptr<const uint8_t> image;    // owned buffer or file mapping
+    size_t size = 0;
+    const IndexHeader* header = nullptr;
 };
 
-vector<string> readDocs(const string& filePath){
-    vector<string> words;
-    ifstream file(filePath);
-    string word;
-    while(file >> word){
-        transform(word.begin(), word.end(), word.begin(), ::tolower);
-        words.push_back(word);
+// Scratch state for a term while the folder is being indexed
+struct PostingBuilder{
+    vector<uint8_t> bytes;
+    uint32_t last_doc = 0;
+    uint32_t doc_frequency = 0;
+};
+
+void encodeVByte(vector<uint8_t>& out, uint32_t value){
+    while(value >= 0x80){
+        out.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+uint32_t decodeVByte(const uint8_t*& p){
+    uint32_t value = 0;
+    int shift = 0;
+    while(*p & 0x80){
+        value |= static_cast<uint32_t>(*p++ & 0x7F) << shift;
+        shift += 7;
     }
-    return words;
+    value |= static_cast<uint32_t>(*p++) << shift;
+    return value;
 }
 
-unordered_map<string, vector<Document>> buildingIndex(const string& folderPath){
-    unordered_map<string, vector<Document>> index;
+// decodeVByte for bytes read from an index file: throws rather than read past end
+uint32_t decodeVByte(const uint8_t*& p, const uint8_t* end){
+    uint32_t value = 0;
+    for(int shift = 0; p < end && shift < 35; shift += 7){
+        uint8_t byte = *p++;
+        value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+        if(!(byte & 0x80)){
+            return value;
+        }
+    }
+    throw runtime_error("corrupt index: postings run past the end of their block");
+}
 
+// Pass the previous result as hash to continue hashing across several buffers
+uint64_t fnv1a(const uint8_t* data, size_t size, uint64_t hash = 14695981039346656037ULL){
+    for(size_t i = 0; i < size; i++){
+        hash ^= data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+template <typename T>
+const T* section(const PositionalIndex& index, uint64_t offset){
+    return reinterpret_cast<const T*>(index.image.get() + offset);
+}
+
+string_view documentName(const PositionalIndex& index, uint32_t docId){
+    const uint32_t* offsets = section<uint32_t>(index, index.header->doc_offsets);
+    return string_view(section<char>(index, index.header->doc_pool) + offsets[docId], offsets[docId + 1] - offsets[docId]);
+}
+
+// Term entries are checked as they are read, against the end of the section they
+// point into (each section ends where the next one starts)
+string_view termAt(const PositionalIndex& index, const TermEntry& entry){
+    uint64_t poolSize = index.header->postings - index.header->term_pool;
+    if(entry.term_offset > poolSize || entry.term_length > poolSize - entry.term_offset){
+        throw runtime_error("corrupt index: term out of range of the term pool");
+    }
+    return string_view(section<char>(index, index.header->term_pool) + entry.term_offset, entry.term_length);
+}
+
+// The postings block ends entry.postings_length bytes later
+const uint8_t* postingsOf(const PositionalIndex& index, const TermEntry& entry){
+    uint64_t postingsSize = index.size - index.header->postings;
+    if(entry.postings_offset > postingsSize || entry.postings_length > postingsSize - entry.postings_offset){
+        throw runtime_error("corrupt index: postings out of range of the postings section");
+    }
+    return section<uint8_t>(index, index.header->postings) + entry.postings_offset;
+}
+
+string readFile(const string& filePath){
+    ifstream file(filePath, ios::binary | ios::ate);
+    string content;
+    if(file){
+        content.resize(static_cast<size_t>(file.tellg()));
+        file.seekg(0);
+        file.read(content.data(), static_cast<streamsize>(content.size()));
+    }
+    return content;
+}
+
+// Heap memory for an arena that keeps count of the bytes it hands out, so what
+// the arena holds can be charged against a memory budget. Single-threaded.
+class CountingResource : public pmr::memory_resource{
+public:
+    size_t bytes() const{ return held; }
+
+private:
+    size_t held = 0;
+
+    void* do_allocate(size_t bytes, size_t alignment) override{
+        void* p = pmr::new_delete_resource()->allocate(bytes, alignment);
+        held += bytes;
+        return p;
+    }
+
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override{
+        pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+        held -= bytes;
+    }
+
+    bool do_is_equal(const pmr::memory_resource& other) const noexcept override{ return this == &other; }
+};
+
+// Copies text into arena memory; the copy lives as long as the arena
+string_view copyInto(pmr::memory_resource& arena, string_view text){
+    char* copy = static_cast<char*>(arena.allocate(max<size_t>(text.size(), 1), 1));
+    memcpy(copy, text.data(), text.size());
+    return string_view(copy, text.size());
+}
+
+// Appends a section to the image, padded so the next one starts 8-byte aligned
+uint64_t appendSection(vector<uint8_t>& image, const void* data, size_t size){
+    uint64_t offset = image.size();
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    image.insert(image.end(), bytes, bytes + size);
+    image.resize((image.size() + 7) & ~static_cast<size_t>(7), 0);
+    return offset;
+}
+
+// Postings for a run of consecutive documents, built by one worker. Doc gaps are
+// relative to the previous document of the run, except the first which is absolute.
+// The term text and the table's nodes come from the block's own arena, which is
+// dropped in one go once the block has been merged.
+struct PartialIndex{
+    CountingResource heap;
+    pmr::monotonic_buffer_resource arena{&heap};
+    pmr::unordered_map<string_view, PostingBuilder> builders{&arena};
+    vector<uint32_t> doc_lengths;
+    vector<float> doc_norms;
+    uint64_t token_count = 0;
+};
+
+// Roughly how much memory a partial block holds: its arena plus the postings
+size_t partialBytes(const PartialIndex& partial){
+    size_t bytes = partial.heap.bytes();
+    for(const auto& entry : partial.builders){
+        bytes += entry.second.bytes.capacity();
+    }
+    return bytes;
+}
+
+void indexDocument(PartialIndex& partial, uint32_t docId, const string& filePath){
+    string content = readFile(filePath);
+    TokenStream words(content.data(), content.size());
+
+    // Group the positions of each word first so tf is known before writing
+    ScratchArena scratch;
+    pmr::unordered_map<string_view, pmr::vector<uint32_t>> positions(scratch.get());
+    string_view word;
+    uint32_t wordCount = 0;
+    while(words.next(word)){
+        positions[word].push_back(wordCount++);
+    }
+    partial.token_count += wordCount;
+
+    double sumSquares = 0;
+    for(const auto& [word, wordPositions] : positions){
+        auto it = partial.builders.find(word);
+        if(it == partial.builders.end()){
+            it = partial.builders.emplace(copyInto(partial.arena, word), PostingBuilder()).first;
+        }
+        PostingBuilder& builder = it->second;
+        encodeVByte(builder.bytes, builder.doc_frequency == 0 ? docId : docId - builder.last_doc);
+        encodeVByte(builder.bytes, static_cast<uint32_t>(wordPositions.size()));
+        uint32_t lastPos = 0;
+        for(uint32_t pos : wordPositions){
+            encodeVByte(builder.bytes, pos - lastPos);
+            lastPos = pos;
+        }
+        builder.last_doc = docId;
+        builder.doc_frequency++;
+        sumSquares += static_cast<double>(wordPositions.size()) * wordPositions.size();
+    }
+    partial.doc_lengths.push_back(wordCount);
+    partial.doc_norms.push_back(static_cast<float>(sqrt(sumSquares)));
+}
+
+// Appends a partial block to the merged postings, which key their terms by views
+// into termArena. Only the first doc gap of each term has to be re-encoded
+// against the previous block; the rest of its bytes are appended unchanged.
+// Returns roughly how many bytes the merged postings and their table grew by; the
+// term text is left to termArena to account for.
+size_t mergePartial(unordered_map<string_view, PostingBuilder>& builders, pmr::memory_resource& termArena,
+                    const PartialIndex& partial){
+    const size_t ENTRY_OVERHEAD = 64;   // hash node, bucket and builder fields
+    size_t grown = 0;
+    for(const auto& [word, part] : partial.builders){
+        auto it = builders.find(word);
+        if(it == builders.end()){
+            it = builders.emplace(copyInto(termArena, word), PostingBuilder()).first;
+            grown += ENTRY_OVERHEAD;
+        }
+        PostingBuilder& builder = it->second;
+        size_t capacity = builder.bytes.capacity();
+        const uint8_t* p = part.bytes.data();
+        uint32_t firstDoc = decodeVByte(p);
+        encodeVByte(builder.bytes, builder.doc_frequency == 0 ? firstDoc : firstDoc - builder.last_doc);
+        builder.bytes.insert(builder.bytes.end(), p, static_cast<const uint8_t*>(part.bytes.data()) + part.bytes.size());
+        builder.last_doc = part.last_doc;
+        builder.doc_frequency += part.doc_frequency;
+        grown += builder.bytes.capacity() - capacity;
+    }
+    return grown;
+}
+
+vector<pair<string_view, PostingBuilder*>> sortedByTerm(unordered_map<string_view, PostingBuilder>& builders){
+    vector<pair<string_view, PostingBuilder*>> sortedTerms;
+    sortedTerms.reserve(builders.size());
+    for(auto& [word, builder] : builders){
+        sortedTerms.emplace_back(word, &builder);
+    }
+    sort(sortedTerms.begin(), sortedTerms.end(), [](const auto& a, const auto& b){ return a.first < b.first; });
+    return sortedTerms;
+}
+
+vector<string> documentPaths(const string& folderPath){
+    vector<string> documents;
     for (const auto& entry : fs::directory_iterator(folderPath) ){
-        string filePath = entry.path().string();
-        vector<string> words = readDocs(filePath);
+        if(entry.is_regular_file()){
+            documents.push_back(entry.path().string());
+        }
+    }
+    return documents;
+}
+
+// Document table sections: offsets into a pool of the document paths
+void documentTable(const vector<string>& documents, string& docPool, vector<uint32_t>& docOffsets){
+    for(const string& doc : documents){
+        docOffsets.push_back(static_cast<uint32_t>(docPool.size()));
+        docPool += doc;
+    }
+    docOffsets.push_back(static_cast<uint32_t>(docPool.size()));
+}
 
-        for(size_t i = 0; i<words.size(); i++){
-            string word = words[i];
-            index[word].push_back({filePath, {static_cast<int>(i)}});
+// Documents get their ids from the directory listing order and are tokenized in
+// blocks by `threads` workers; blocks are then merged in id order, so the index
+// is byte-identical to a single-threaded build.
+PositionalIndex buildingIndex(const string& folderPath, unsigned threads = 1){
+    const size_t BLOCK_SIZE = 16;
+    vector<string> documents = documentPaths(folderPath);
+
+    vector<unique_ptr<PartialIndex>> partials((documents.size() + BLOCK_SIZE - 1) / BLOCK_SIZE);
+    parallelFor(partials.size(), threads, [&](size_t block){
+        partials[block] = make_unique<PartialIndex>();
+        size_t last = min(documents.size(), (block + 1) * BLOCK_SIZE);
+        for(size_t docId = block * BLOCK_SIZE; docId < last; docId++){
+            indexDocument(*partials[block], static_cast<uint32_t>(docId), documents[docId]);
         }
+    });
+
+    vector<uint32_t> docLengths;
+    vector<float> docNorms;
+    uint64_t tokenCount = 0;
+    pmr::monotonic_buffer_resource termArena;
+    unordered_map<string_view, PostingBuilder> builders;
+    for(unique_ptr<PartialIndex>& partial : partials){
+        mergePartial(builders, termArena, *partial);
+        docLengths.insert(docLengths.end(), partial->doc_lengths.begin(), partial->doc_lengths.end());
+        docNorms.insert(docNorms.end(), partial->doc_norms.begin(), partial->doc_norms.end());
+        tokenCount += partial->token_count;
+        partial.reset();
+    }
+
+    // Lay the dictionary and all postings blocks out contiguously in term order
+    vector<pair<string_view, PostingBuilder*>> sortedTerms = sortedByTerm(builders);
+    string termPool;
+    vector<TermEntry> terms;
+    vector<uint8_t> postings;
+    terms.reserve(sortedTerms.size());
+    for(const auto& [word, entry] : sortedTerms){
+        PostingBuilder& builder = *entry;
+        terms.push_back({static_cast<uint32_t>(termPool.size()), static_cast<uint32_t>(word.size()),
+                         postings.size(), static_cast<uint32_t>(builder.bytes.size()), builder.doc_frequency});
+        termPool += word;
+        postings.insert(postings.end(), builder.bytes.begin(), builder.bytes.end());
+        vector<uint8_t>().swap(builder.bytes);
     }
 
+    string docPool;
+    vector<uint32_t> docOffsets;
+    documentTable(documents, docPool, docOffsets);
+
+    IndexHeader header = {};
+    copy(begin(INDEX_MAGIC), end(INDEX_MAGIC), header.magic);
+    header.version = INDEX_VERSION;
+    header.header_size = sizeof(IndexHeader);
+    header.token_count = tokenCount;
+    header.doc_count = static_cast<uint32_t>(documents.size());
+    header.term_count = static_cast<uint32_t>(terms.size());
+
+    auto image = make_shared<vector<uint8_t>>(sizeof(IndexHeader), 0);
+    image->reserve(sizeof(IndexHeader) + docPool.size() + termPool.size() + postings.size() +
+                   terms.size() * sizeof(TermEntry) + documents.size() * 16 + 64);
+    header.doc_offsets = appendSection(*image, docOffsets.data(), docOffsets.size() * sizeof(uint32_t));
+    header.doc_pool = appendSection(*image, docPool.data(), docPool.size());
+    header.doc_lengths = appendSection(*image, docLengths.data(), docLengths.size() * sizeof(uint32_t));
+    header.doc_norms = appendSection(*image, docNorms.data(), docNorms.size() * sizeof(float));
+    header.terms = appendSection(*image, terms.data(), terms.size() * sizeof(TermEntry));
+    header.term_pool = appendSection(*image, termPool.data(), termPool.size());
+    header.postings = appendSection(*image, postings.data(), postings.size());
+    header.file_size = image->size();
+    header.checksum = fnv1a(image->data() + sizeof(IndexHeader), image->size() - sizeof(IndexHeader));
+    memcpy(image->data(), &header, sizeof(IndexHeader));
+
+    PositionalIndex index;
+    index.image = shared_ptr<const uint8_t>(image, image->data());
+    index.size = image->size();
+    index.header = section<IndexHeader>(index, 0);
     return index;
 }
 
-void wordSearching(const unordered_map<string, vector<Document>>& index, const string& query){
-    auto it = index.find(query);
-    if(it != index.end()){
-        const vector<Document>& documents = it->second;
-        cout << "Found the word \"" << query << "\" in the following documents:\n";
-        for(const auto& doc : documents){
-            cout << "Document: " << doc.doc_name << ", Position(s): ";
-            for (int pos : doc.word_position) {
-                cout << pos << " ";
+// Writes the index image to disk; the file is written next to the target and
+// renamed into place so readers never see a half-written index.
+void saveIndex(const PositionalIndex& index, const string& indexPath){
+    string tempPath = indexPath + ".tmp";
+    {
+        ofstream out(tempPath, ios::binary | ios::trunc);
+        out.write(reinterpret_cast<const char*>(index.image.get()), static_cast<streamsize>(index.size));
+        if(!out){
+            throw runtime_error("could not write index file " + tempPath);
+        }
+    }
+    fs::rename(tempPath, indexPath);
+}
+
+// Checks that the sections the header points to are aligned, in layout order and
+// inside the image, that the fixed-size tables fit their sections and that the
+// document table stays inside its pool, so the tables can be read unchecked
+void validateSections(const PositionalIndex& index, const string& indexPath){
+    const IndexHeader& header = *index.header;
+    const uint64_t starts[] = {header.header_size, header.doc_offsets, header.doc_pool, header.doc_lengths,
+                               header.doc_norms, header.terms, header.term_pool, header.postings, index.size};
+    for(size_t i = 1; i < size(starts); i++){
+        if(starts[i] < starts[i - 1] || (i + 1 < size(starts) && starts[i] % 8 != 0)){
+            throw runtime_error("index file " + indexPath + " has a corrupt section table");
+        }
+    }
+    auto fits = [](uint64_t start, uint64_t end, uint64_t count, uint64_t width){
+        return count <= (end - start) / width;
+    };
+    if(!fits(header.doc_offsets, header.doc_pool, static_cast<uint64_t>(header.doc_count) + 1, sizeof(uint32_t)) ||
+       !fits(header.doc_lengths, header.doc_norms, header.doc_count, sizeof(uint32_t)) ||
+       !fits(header.doc_norms, header.terms, header.doc_count, sizeof(float)) ||
+       !fits(header.terms, header.term_pool, header.term_count, sizeof(TermEntry))){
+        throw runtime_error("index file " + indexPath + " has a section too short for its table");
+    }
+    const uint32_t* offsets = section<uint32_t>(index, header.doc_offsets);
+    for(uint32_t docId = 0; docId < header.doc_count; docId++){
+        if(offsets[docId] > offsets[docId + 1]){
+            throw runtime_error("index file " + indexPath + " has a corrupt document table");
+        }
+    }
+    if(offsets[header.doc_count] > header.doc_lengths - header.doc_pool){
+        throw runtime_error("index file " + indexPath + " has a corrupt document table");
+    }
+}
+
+// Opens an index file written by saveIndex. The header and the section layout
+// are validated here and term entries as they are read, so a damaged file
+// cannot make a query read outside the mapping. The payload checksum takes a
+// pass over the whole file and is left to verifyIndex, which --index and
+// --verify-index run before using the file.
+PositionalIndex loadIndex(const string& indexPath){
+    PositionalIndex index;
+#ifdef _WIN32
+    ifstream in(indexPath, ios::binary);
+    if(!in){
+        throw runtime_error("could not open index file " + indexPath);
+    }
+    auto buffer = make_shared<vector<uint8_t>>((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+    index.image = shared_ptr<const uint8_t>(buffer, buffer->data());
+    index.size = buffer->size();
+#else
+    int fd = open(indexPath.c_str(), O_RDONLY);
+    if(fd < 0){
+        throw runtime_error("could not open index file " + indexPath);
+    }
+    struct stat info;
+    if(fstat(fd, &info) != 0 || info.st_size < static_cast<off_t>(sizeof(IndexHeader))){
+        close(fd);
+        throw runtime_error("index file " + indexPath + " is truncated");
+    }
+    size_t size = static_cast<size_t>(info.st_size);
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED){
+        throw runtime_error("could not map index file " + indexPath);
+    }
+    index.image = shared_ptr<const uint8_t>(static_cast<const uint8_t*>(mapping), [size](const uint8_t* p){
+        munmap(const_cast<uint8_t*>(p), size);
+    });
+    index.size = size;
+#endif
+    if(index.size < sizeof(IndexHeader)){
+        throw runtime_error("index file " + indexPath + " is truncated");
+    }
+    index.header = section<IndexHeader>(index, 0);
+    if(!equal(begin(INDEX_MAGIC), end(INDEX_MAGIC), index.header->magic)){
+        throw runtime_error(indexPath + " is not an index file");
+    }
+    if(index.header->version != INDEX_VERSION || index.header->header_size != sizeof(IndexHeader)){
+        throw runtime_error("index file " + indexPath + " has unsupported version " + to_string(index.header->version));
+    }
+    if(index.header->file_size != index.size){
+        throw runtime_error("index file " + indexPath + " is truncated");
+    }
+    validateSections(index, indexPath);
+    return index;
+}
+
+// One sorted run of a bounded-memory build on disk: per term, in term order,
+//   [term length][term][doc frequency][last doc][postings length][postings]
+// with the numbers as raw uint32_t and the postings encoded as in PostingBuilder,
+// their first doc gap absolute
+void writeRun(const string& runPath, unordered_map<string_view, PostingBuilder>& builders){
+    ofstream out(runPath, ios::binary | ios::trunc);
+    for(const auto& [word, builder] : sortedByTerm(builders)){
+        uint32_t fields[] = {static_cast<uint32_t>(word.size()), builder->doc_frequency, builder->last_doc,
+                             static_cast<uint32_t>(builder->bytes.size())};
+        out.write(reinterpret_cast<const char*>(&fields[0]), sizeof(uint32_t));
+        out.write(word.data(), static_cast<streamsize>(word.size()));
+        out.write(reinterpret_cast<const char*>(&fields[1]), 3 * sizeof(uint32_t));
+        out.write(reinterpret_cast<const char*>(builder->bytes.data()), static_cast<streamsize>(builder->bytes.size()));
+    }
+    if(!out){
+        throw runtime_error("could not write run file " + runPath);
+    }
+}
+
+// Reads a run back one term at a time
+struct RunReader{
+    ifstream in;
+    vector<char> buffer = vector<char>(1 << 20);
+    string term;
+    PostingBuilder builder;
+
+    explicit RunReader(const string& runPath){
+        in.rdbuf()->pubsetbuf(buffer.data(), static_cast<streamsize>(buffer.size()));
+        in.open(runPath, ios::binary);
+    }
+
+    bool next(){
+        uint32_t length;
+        if(!in.read(reinterpret_cast<char*>(&length), sizeof(length))){
+            return false;
+        }
+        term.resize(length);
+        uint32_t fields[3];
+        in.read(term.data(), length);
+        in.read(reinterpret_cast<char*>(fields), sizeof(fields));
+        builder.doc_frequency = fields[0];
+        builder.last_doc = fields[1];
+        builder.bytes.resize(fields[2]);
+        in.read(reinterpret_cast<char*>(builder.bytes.data()), fields[2]);
+        if(!in){
+            throw runtime_error("run file is truncated");
+        }
+        return true;
+    }
+};
+
+// Writes sections to a file laid out and padded like appendSection does in
+// memory, hashing everything after the header as it goes
+struct SectionWriter{
+    ofstream out;
+    uint64_t size = 0;
+    uint64_t hash = fnv1a(nullptr, 0);
+
+    void write(const void* data, size_t bytes){
+        out.write(static_cast<const char*>(data), static_cast<streamsize>(bytes));
+        if(size >= sizeof(IndexHeader)){
+            hash = fnv1a(static_cast<const uint8_t*>(data), bytes, hash);
+        }
+        size += bytes;
+    }
+
+    void pad(){
+        static const uint8_t zeros[8] = {};
+        write(zeros, ((size + 7) & ~static_cast<uint64_t>(7)) - size);
+    }
+
+    uint64_t append(const void* data, size_t bytes){
+        uint64_t offset = size;
+        write(data, bytes);
+        pad();
+        return offset;
+    }
+};
+
+// Builds the index file for a folder without ever holding the whole index in
+// memory (single-pass in-memory indexing). Documents are indexed in waves of
+// blocks as in buildingIndex and merged into an in-memory run; whenever the run
+// grows past budgetBytes it is written out sorted by term and dropped. The runs
+// are then merged k ways, each term's postings streamed to a scratch file, and
+// the index file is assembled from the document tables, the dictionary and that
+// file. Runs cover consecutive documents in order, so the file is byte-identical
+// to buildingIndex + saveIndex. The budget covers the run, its term arena and the
+// blocks in flight: the run is flushed before a wave when the last wave's size
+// would not fit beside it, and waves shrink while one takes over half the budget.
+// Besides the budget, memory holds one record per run while merging, the
+// dictionary and the per-document tables. Run and scratch files are removed
+// however the build ends.
+void buildIndexFile(const string& folderPath, const string& indexPath, unsigned threads, size_t budgetBytes){
+    const size_t BLOCK_SIZE = 16;
+    vector<string> documents = documentPaths(folderPath);
+    size_t blockCount = (documents.size() + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+    // Removes the files below when the build ends, finished or not
+    struct ScratchFiles{
+        vector<string> paths;
+        ~ScratchFiles(){
+            for(const string& path : paths){
+                error_code ignored;
+                if(fs::is_regular_file(path, ignored)){
+                    fs::remove(path, ignored);
+                }
+            }
+        }
+    } scratch;
+    string postingsPath = indexPath + ".postings";
+    string tempPath = indexPath + ".tmp";
+    scratch.paths = {postingsPath, tempPath};
+
+    vector<string> runPaths;
+    vector<uint32_t> docLengths;
+    vector<float> docNorms;
+    uint64_t tokenCount = 0;
+    CountingResource termHeap;
+    auto termArena = make_unique<pmr::monotonic_buffer_resource>(&termHeap);
+    unordered_map<string_view, PostingBuilder> builders;
+    size_t runBytes = 0;
+    auto flushRun = [&](){
+        if(builders.empty()){
+            return;
+        }
+        runPaths.push_back(indexPath + ".run" + to_string(runPaths.size()));
+        scratch.paths.push_back(runPaths.back());
+        writeRun(runPaths.back(), builders);
+        unordered_map<string_view, PostingBuilder>().swap(builders);
+        termArena = make_unique<pmr::monotonic_buffer_resource>(&termHeap);
+        runBytes = 0;
+    };
+
+    size_t waveBlocks = max(threads, 1u);
+    size_t waveBytes = 0;   // what the last wave held, taken as the size of the next
+    for(size_t wave = 0; wave < blockCount; wave += waveBlocks){
+        if(runBytes + termHeap.bytes() + waveBytes > budgetBytes){
+            flushRun();
+        }
+        vector<unique_ptr<PartialIndex>> partials(min(waveBlocks, blockCount - wave));
+        parallelFor(partials.size(), threads, [&](size_t i){
+            partials[i] = make_unique<PartialIndex>();
+            size_t block = wave + i;
+            size_t last = min(documents.size(), (block + 1) * BLOCK_SIZE);
+            for(size_t docId = block * BLOCK_SIZE; docId < last; docId++){
+                indexDocument(*partials[i], static_cast<uint32_t>(docId), documents[docId]);
+            }
+        });
+        waveBytes = 0;
+        for(const unique_ptr<PartialIndex>& partial : partials){
+            waveBytes += partialBytes(*partial);
+        }
+        size_t pending = waveBytes;
+        for(unique_ptr<PartialIndex>& partial : partials){
+            pending -= partialBytes(*partial);
+            runBytes += mergePartial(builders, *termArena, *partial);
+            docLengths.insert(docLengths.end(), partial->doc_lengths.begin(), partial->doc_lengths.end());
+            docNorms.insert(docNorms.end(), partial->doc_norms.begin(), partial->doc_norms.end());
+            tokenCount += partial->token_count;
+            partial.reset();
+            if(runBytes + termHeap.bytes() + pending > budgetBytes){
+                flushRun();
             }
-            cout << "\n";
+        }
+        if(waveBytes > budgetBytes / 2 && waveBlocks > 1){
+            waveBlocks /= 2;
         }
     }
-    else{
-        cout << "No result found for \"" << query << "\".\n";
+    flushRun();
+    termArena.reset();
+
+    // k-way merge: a term's records are combined in run order, which is doc order
+    vector<unique_ptr<RunReader>> runs;
+    auto later = [&](size_t a, size_t b){
+        int order = runs[a]->term.compare(runs[b]->term);
+        return order != 0 ? order > 0 : a > b;
+    };
+    priority_queue<size_t, vector<size_t>, decltype(later)> heap(later);
+    for(const string& runPath : runPaths){
+        runs.push_back(make_unique<RunReader>(runPath));
+        if(runs.back()->next()){
+            heap.push(runs.size() - 1);
+        }
+    }
+
+    ofstream postingsOut(postingsPath, ios::binary | ios::trunc);
+    string termPool;
+    vector<TermEntry> terms;
+    uint64_t postingsSize = 0;
+    string current;
+    PostingBuilder merged;
+    auto emitTerm = [&](){
+        if(merged.doc_frequency == 0){
+            return;
+        }
+        terms.push_back({static_cast<uint32_t>(termPool.size()), static_cast<uint32_t>(current.size()),
+                         postingsSize, static_cast<uint32_t>(merged.bytes.size()), merged.doc_frequency});
+        termPool += current;
+        postingsOut.write(reinterpret_cast<const char*>(merged.bytes.data()), static_cast<streamsize>(merged.bytes.size()));
+        postingsSize += merged.bytes.size();
+        merged = PostingBuilder();
+    };
+    while(!heap.empty()){
+        size_t r = heap.top();
+        heap.pop();
+        RunReader& run = *runs[r];
+        if(run.term != current){
+            emitTerm();
+            current = run.term;
+        }
+        const uint8_t* p = run.builder.bytes.data();
+        uint32_t firstDoc = decodeVByte(p);
+        encodeVByte(merged.bytes, merged.doc_frequency == 0 ? firstDoc : firstDoc - merged.last_doc);
+        merged.bytes.insert(merged.bytes.end(), p, static_cast<const uint8_t*>(run.builder.bytes.data()) + run.builder.bytes.size());
+        merged.last_doc = run.builder.last_doc;
+        merged.doc_frequency += run.builder.doc_frequency;
+        if(run.next()){
+            heap.push(r);
+        }
+    }
+    emitTerm();
+    postingsOut.close();
+    if(!postingsOut){
+        throw runtime_error("could not write " + postingsPath);
+    }
+    runs.clear();
+    for(const string& runPath : runPaths){
+        fs::remove(runPath);
+    }
+
+    string docPool;
+    vector<uint32_t> docOffsets;
+    documentTable(documents, docPool, docOffsets);
+
+    IndexHeader header = {};
+    copy(begin(INDEX_MAGIC), end(INDEX_MAGIC), header.magic);
+    header.version = INDEX_VERSION;
+    header.header_size = sizeof(IndexHeader);
+    header.token_count = tokenCount;
+    header.doc_count = static_cast<uint32_t>(documents.size());
+    header.term_count = static_cast<uint32_t>(terms.size());
+
+    SectionWriter writer;
+    writer.out.open(tempPath, ios::binary | ios::trunc);
+    writer.write(&header, sizeof(IndexHeader));
+    header.doc_offsets = writer.append(docOffsets.data(), docOffsets.size() * sizeof(uint32_t));
+    header.doc_pool = writer.append(docPool.data(), docPool.size());
+    header.doc_lengths = writer.append(docLengths.data(), docLengths.size() * sizeof(uint32_t));
+    header.doc_norms = writer.append(docNorms.data(), docNorms.size() * sizeof(float));
+    header.terms = writer.append(terms.data(), terms.size() * sizeof(TermEntry));
+    header.term_pool = writer.append(termPool.data(), termPool.size());
+    header.postings = writer.size;
+    {
+        ifstream postingsIn(postingsPath, ios::binary);
+        vector<char> chunk(1 << 20);
+        while(postingsIn.read(chunk.data(), static_cast<streamsize>(chunk.size())) || postingsIn.gcount() > 0){
+            writer.write(chunk.data(), static_cast<size_t>(postingsIn.gcount()));
+        }
     }
+    writer.pad();
+    header.file_size = writer.size;
+    header.checksum = writer.hash;
+    writer.out.seekp(0);
+    writer.out.write(reinterpret_cast<const char*>(&header), sizeof(IndexHeader));
+    writer.out.close();
+    if(!writer.out){
+        throw runtime_error("could not write index file " + tempPath);
+    }
+    fs::remove(postingsPath);
+    fs::rename(tempPath, indexPath);
 }
 
+bool verifyIndex(const PositionalIndex& index){
+    return fnv1a(index.image.get() + sizeof(IndexHeader), index.size - sizeof(IndexHeader)) == index.header->checksum;
+}
 
-vector<string> listDocuments(const string& folderPath) {
-    vector<string> documents;
-    for (const auto& entry : fs::directory_iterator(folderPath)) {
-        if (entry.is_regular_file()) {
-            documents.push_back(entry.path().filename().string());
+const TermEntry* findTerm(const PositionalIndex& index, string_view term){
+    const TermEntry* first = section<TermEntry>(index, index.header->terms);
+    const TermEntry* last = first + index.header->term_count;
+    const TermEntry* it = lower_bound(first, last, term, [&](const TermEntry& entry, string_view value){
+        return termAt(index, entry) < value;
+    });
+    if(it != last && termAt(index, *it) == term){
+        return it;
+    }
+    return nullptr;
+}
+
+// A dictionary term within a few edits of a query, with its postings
+struct FuzzyMatch{
+    const TermEntry* entry;
+    int distance;
+};
+
+// Walks the sorted dictionary with a Levenshtein automaton for query: the
+// automaton's state after a prefix is the row of edit distances between that
+// prefix and every prefix of the query. Consecutive terms share their rows up to
+// their common prefix, and once every entry of a row exceeds maxDistance no
+// term starting with that prefix can match, so the whole run of them is skipped
+// with one binary search. Only prefixes the automaton can still accept are
+// visited, not the whole dictionary.
+vector<FuzzyMatch> fuzzyTerms(const PositionalIndex& index, string_view query, int maxDistance){
+    const TermEntry* first = section<TermEntry>(index, index.header->terms);
+    const TermEntry* last = first + index.header->term_count;
+    size_t m = query.size();
+
+    vector<FuzzyMatch> matches;
+    string path;                          // prefix the rows below belong to
+    vector<int> rows(m + 1);              // row j, for the first j bytes of path, at j * (m + 1)
+    for(size_t k = 0; k <= m; k++){
+        rows[k] = static_cast<int>(k);
+    }
+
+    const TermEntry* it = first;
+    while(it != last){
+        string_view term = termAt(index, *it);
+        size_t common = 0;
+        while(common < path.size() && common < term.size() && path[common] == term[common]){
+            common++;
+        }
+        path.resize(common);
+        rows.resize((common + 1) * (m + 1));
+
+        bool dead = false;
+        for(size_t j = common; j < term.size() && !dead; j++){
+            rows.resize(rows.size() + m + 1);
+            const int* previous = rows.data() + j * (m + 1);
+            int* row = rows.data() + (j + 1) * (m + 1);
+            row[0] = previous[0] + 1;
+            int best = row[0];
+            for(size_t k = 1; k <= m; k++){
+                row[k] = min({previous[k] + 1, row[k - 1] + 1, previous[k - 1] + (query[k - 1] != term[j])});
+                best = min(best, row[k]);
+            }
+            path.push_back(term[j]);
+            dead = best > maxDistance;
+        }
+
+        if(dead){
+            // Every term from here on that starts with path is out of reach. Most
+            // such runs are short, so the end is galloped to before the binary search.
+            auto hasPrefix = [&](const TermEntry& entry){
+                return termAt(index, entry).substr(0, path.size()) == path;
+            };
+            size_t step = 1;
+            const TermEntry* bound = it + 1;
+            while(bound < last && hasPrefix(*bound)){
+                it = bound;
+                step *= 2;
+                bound = it + min<size_t>(step, last - it);
+            }
+            it = partition_point(it + 1, bound, hasPrefix);
+        }
+        else{
+            int distance = rows[term.size() * (m + 1) + m];
+            if(distance <= maxDistance){
+                matches.push_back({it, distance});
+            }
+            it++;
         }
     }
-    return documents;
+    return matches;
+}
+
+// Edits allowed for a word of this length: one for short words, two otherwise
+int typoBudget(size_t length){
+    return length <= 4 ? 1 : 2;
+}
+
+void printPostings(const PositionalIndex& index, const TermEntry& entry){
+    const uint8_t* p = postingsOf(index, entry);
+    const uint8_t* end = p + entry.postings_length;
+    uint32_t docId = 0;
+    for(uint32_t d = 0; d < entry.doc_frequency; d++){
+        docId += decodeVByte(p, end);
+        if(docId >= index.header->doc_count){
+            throw runtime_error("corrupt index: posting for an unknown document");
+        }
+        uint32_t tf = decodeVByte(p, end);
+        cout << "Document: " << documentName(index, docId) << ", Position(s): ";
+        uint32_t pos = 0;
+        for(uint32_t i = 0; i < tf; i++){
+            pos += decodeVByte(p, end);
+            cout << pos << " ";
+        }
+        cout << "\n";
+    }
+}
+
+// Prints where the word occurs; if it is not in the dictionary, the terms within
+// typoBudget edits are listed closest and most frequent first, and the postings
+// of the best one are shown as a "did you mean" suggestion
+void wordSearching(const PositionalIndex& index, const string& query){
+    // Terms are indexed lowercased, so "Hello" is looked up (and corrected) as "hello"
+    string word = query;
+    for(char& c : word){
+        c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+    }
+    const TermEntry* entry = findTerm(index, word);
+    if(entry != nullptr){
+        cout << "Found the word \"" << query << "\" in the following documents:\n";
+        printPostings(index, *entry);
+        return;
+    }
+
+    cout << "No result found for \"" << query << "\".\n";
+    vector<FuzzyMatch> matches = fuzzyTerms(index, word, typoBudget(word.size()));
+    if(matches.empty()){
+        return;
+    }
+    sort(matches.begin(), matches.end(), [](const FuzzyMatch& a, const FuzzyMatch& b){
+        return a.distance != b.distance ? a.distance < b.distance : a.entry->doc_frequency > b.entry->doc_frequency;
+    });
+    cout << "Close matches:";
+    for(size_t i = 0; i < matches.size() && i < 10; i++){
+        cout << " " << termAt(index, *matches[i].entry) << " (" << matches[i].distance << " edit"
+             << (matches[i].distance == 1 ? "" : "s") << ", " << matches[i].entry->doc_frequency << " document"
+             << (matches[i].entry->doc_frequency == 1 ? "" : "s") << ")";
+    }
+    cout << "\nDid you mean \"" << termAt(index, *matches[0].entry) << "\"? It occurs in:\n";
+    printPostings(index, *matches[0].entry);
+}
+
+// Reports how many bytes the index costs per indexed token, next to an estimate
+// of the old layout (one Document with its own path copy and vector per occurrence)
+void memoryReport(const PositionalIndex& index){
+    const IndexHeader& header = *index.header;
+    size_t documentBytes = header.terms - header.doc_offsets;
+    size_t dictionaryBytes = header.postings - header.terms;
+    size_t postingBytes = index.size - header.postings;
+
+    // Old layout per token: the Document itself, its heap-allocated path (when longer
+    // than the small-string buffer), a one-int vector allocation (a 32 byte malloc
+    // chunk) and, per term, the unordered_map node.
+    double pathBytes = header.doc_lengths - header.doc_pool;
+    double avgPath = header.doc_count == 0 ? 0.0 : pathBytes / header.doc_count;
+    double legacyPerToken = sizeof(vector<int>) + sizeof(string) + (avgPath > 15 ? avgPath + 1 : 0.0) + 32.0;
+    double legacyTotal = legacyPerToken * header.token_count +
+                         header.term_count * (sizeof(string) + sizeof(vector<int>) + 2 * sizeof(void*));
+
+    cout << "Documents: " << header.doc_count << ", Terms: " << header.term_count
+         << ", Tokens: " << header.token_count << "\n";
+    cout << "Document table: " << documentBytes << " bytes\n";
+    cout << "Dictionary: " << dictionaryBytes << " bytes\n";
+    cout << "Postings: " << postingBytes << " bytes\n";
+    if(header.token_count > 0){
+        cout << "Bytes per token: " << static_cast<double>(index.size) / header.token_count
+             << " (previous layout: ~" << legacyTotal / header.token_count << ")\n";
+    }
 }
 
-void searchDocumentByName(const string& folderPath, const string& query) {
-    bool found = false;
-    for (const auto& entry : fs::directory_iterator(folderPath)) {
-        if (entry.is_regular_file()) {
-            string filename = entry.path().filename().string();
-            if (filename.find(query) != string::npos) {
-                cout << "Found document: " << filename << endl;
-                found = true;
+// Index of the document file names, built from the document table of an index
+NameIndex documentNameIndex(const PositionalIndex& index){
+    NameIndex names;
+    for(uint32_t docId = 0; docId < index.header->doc_count; docId++){
+        names.add(fs::path(string(documentName(index, docId))).filename().string());
+    }
+    return names;
+}
+
+// A trailing '*' asks for names starting with the rest of the query; otherwise
+// names containing it are listed, after any that match it exactly once
+// extensions are ignored
+void searchDocumentByName(const NameIndex& names, const string& query) {
+    vector<string> found;
+    if(!query.empty() && query.back() == '*'){
+        found = names.withPrefix(query.substr(0, query.size() - 1));
+    }
+    else{
+        found = names.withStem(query);
+        for(const string& name : names.containing(query)){
+            if(find(found.begin(), found.end(), name) == found.end()){
+                found.push_back(name);
             }
         }
     }
-    if (!found) {
+    for(const string& name : found){
+        cout << "Found document: " << name << endl;
+    }
+    if (found.empty()) {
         cout << "No documents found matching \"" << query << "\"." << endl;
     }
 }
+
+// Times building the index of a folder, then looking up the first word of every
+// line of queryFile with all of its postings and positions decoded
+void benchmarkQueries(const string& folderPath, const string& queryFile, unsigned threads){
+    uint64_t bytes = 0;
+    for(const auto& entry : fs::directory_iterator(folderPath)){
+        if(entry.is_regular_file()){
+            bytes += entry.file_size();
+        }
+    }
+    auto start = chrono::steady_clock::now();
+    PositionalIndex index = buildingIndex(folderPath, threads);
+    reportIndexing(index.header->doc_count, bytes, chrono::duration<double>(chrono::steady_clock::now() - start).count());
+
+    // The first word of each line, and the same words with their second letter dropped as typos
+    vector<string> words, typos;
+    for(const string& line : readBenchQueries(queryFile)){
+        string word = line.substr(0, line.find(' '));
+        if(!word.empty()){
+            words.push_back(word);
+        }
+        if(word.size() >= 2){
+            typos.push_back(word.erase(1, 1));
+        }
+    }
+
+    uint64_t positions = 0;
+    timeQueries("word", words, [&](const string& word){
+        const TermEntry* entry = findTerm(index, word);
+        if(entry == nullptr){
+            return;
+        }
+        const uint8_t* p = postingsOf(index, *entry);
+        const uint8_t* end = p + entry->postings_length;
+        for(uint32_t d = 0; d < entry->doc_frequency; d++){
+            decodeVByte(p, end);
+            uint32_t tf = decodeVByte(p, end);
+            for(uint32_t i = 0; i < tf; i++){
+                positions += decodeVByte(p, end) != 0;
+            }
+        }
+    });
+    cout << "Looked up " << words.size() << " words, " << positions << " positions decoded\n";
+
+    size_t candidates = 0;
+    timeQueries("fuzzy", typos, [&](const string& word){
+        candidates += fuzzyTerms(index, word, typoBudget(word.size())).size();
+    });
+    cout << "Found " << candidates << " fuzzy candidates for " << typos.size() << " misspelled words\n";
+}
+
 bool isInteger(const string& str) {
     for (char c : str) {
         if (!::isdigit(c)) {
@@ -95,20 +1037,81 @@ bool isInteger(const string& str) {
 }
 
 
-int main()
+int main(int argc, char* argv[])
 {
     string folder_Path = ".";
-    unordered_map<string, vector<Document>> index = buildingIndex(folder_Path);
+    PositionalIndex index;
 
     try{
+        // Tool modes: build an index file once, check one, or serve queries from one.
+        // --threads <n> sets the number of indexing workers (default: all cores);
+        // --memory-mb <n> makes --build-index work within about n MB, spilling
+        // sorted runs next to the index file and merging them at the end.
+        vector<string> args(argv + 1, argv + argc);
+        unsigned threads = max(1u, thread::hardware_concurrency());
+        auto threadsFlag = find(args.begin(), args.end(), "--threads");
+        if (threadsFlag != args.end() && threadsFlag + 1 != args.end() && isInteger(*(threadsFlag + 1))) {
+            threads = max(1, stoi(*(threadsFlag + 1)));
+            args.erase(threadsFlag, threadsFlag + 2);
+        }
+        size_t memoryBudget = 0;
+        auto memoryFlag = find(args.begin(), args.end(), "--memory-mb");
+        if (memoryFlag != args.end() && memoryFlag + 1 != args.end() && isInteger(*(memoryFlag + 1))) {
+            memoryBudget = static_cast<size_t>(max(1, stoi(*(memoryFlag + 1)))) << 20;
+            args.erase(memoryFlag, memoryFlag + 2);
+        }
+
+        string mode = args.empty() ? "" : args[0];
+        if (mode == "--build-index" && args.size() == 3) {
+            if(memoryBudget > 0){
+                buildIndexFile(args[1], args[2], threads, memoryBudget);
+                index = loadIndex(args[2]);
+            }
+            else{
+                index = buildingIndex(args[1], threads);
+                saveIndex(index, args[2]);
+            }
+            cout << "Wrote index for " << index.header->doc_count << " documents to " << args[2] << "\n";
+            memoryReport(index);
+            return 0;
+        }
+        else if (mode == "--verify-index" && args.size() == 2) {
+            index = loadIndex(args[1]);
+            bool valid = verifyIndex(index);
+            cout << args[1] << (valid ? ": checksum OK\n" : ": checksum mismatch\n");
+            return valid ? 0 : 1;
+        }
+        else if (mode == "--index" && args.size() == 2) {
+            index = loadIndex(args[1]);
+            if (!verifyIndex(index)) {
+                throw runtime_error("index file " + args[1] + " failed its checksum");
+            }
+        }
+        else if (mode == "--bench-tokenizer" && args.size() == 2) {
+            benchmarkTokenizer<TokenRule::Whitespace>(args[1]);
+            return 0;
+        }
+        else if (mode == "--bench-queries" && args.size() == 2) {
+            benchmarkQueries(folder_Path, args[1], threads);
+            return 0;
+        }
+        else if (!args.empty()) {
+            cout << "Usage: " << argv[0] << " [--threads <n>] [--memory-mb <n>] [--build-index <folder> <index file> | --verify-index <index file> | --index <index file> | --bench-tokenizer <file> | --bench-queries <query file>]\n";
+            return 1;
+        }
+        else {
+            index = buildingIndex(folder_Path, threads);
+        }
+        NameIndex names = documentNameIndex(index);
 
         while (true) {
             cout << "\nChoose an option:\n";
             cout << "1. Search for a word\n";
             cout << "2. List all documents\n";
             cout << "3. Search for a document by name\n";
-            cout << "4. Exit\n";
-            cout << "Enter your choice (1-4): ";
+            cout << "4. Show index memory usage\n";
+            cout << "5. Exit\n";
+            cout << "Enter your choice (1-5): ";
             
             string op;
             cin >> op;
@@ -121,8 +1124,10 @@ int main()
                     wordSearching(index, query);
                 }
                 else if (choice == 2) {
-                    vector<string> documents = listDocuments(folder_Path);
-                    cout << "Documents in the folder:\n";
+                    // The documents searched are the index's, which for --index need
+                    // not be the files in the working folder
+                    vector<string> documents = names.all();
+                    cout << (mode == "--index" ? "Documents in the index:\n" : "Documents in the folder:\n");
                     for (const auto& doc : documents) {
                         cout << doc << endl;
                     }
@@ -132,9 +1137,12 @@ int main()
                     cout << "Enter a document name to search: ";
                     cin.ignore(); // Clear the input buffer
                     getline(cin, query);
-                    searchDocumentByName(folder_Path, query);
+                    searchDocumentByName(names, query);
                 }
                 else if (choice == 4) {
+                    memoryReport(index);
+                }
+                else if (choice == 5) {
                     cout << "Exiting the program.\n";
                     break;
                 }
@@ -143,12 +1151,12 @@ int main()
                 } 
             }
             else{
-                cout << "Invalid choice. Please enter a number between 1 and 4.\n";
+                cout << "Invalid choice. Please enter a number between 1 and 5.\n";
                 continue;
             }
         }
     }
-    catch(exception e){
+    catch(const exception& e){
         cout << "Error: " << e.what() << endl;
     }
 
@@ -6,12 +6,41 @@
 #include <algorithm>
 #include <sstream>
 #include <unordered_set>
+#include <unordered_map>
 #include <filesystem>
+#include <chrono>
+#include <deque>
+#include <string_view>
+#include <cstdint>
+#include <stdexcept>
+#include <memory>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <random>
+#include <array>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "../common/token_stream.h"
+#include "../common/bench_report.h"
+#include "../common/vocabulary.h"
 
 using namespace std;
 
 namespace fs = filesystem;
 
+// Keywords as split_string(filter_string(text)) gives them: whitespace-separated
+// words, lowercased, with every non-alphanumeric character dropped
+using TokenStream = BasicTokenStream<TokenRule::Squeezed>;
+using ChunkedTokens = BasicChunkedTokens<TokenRule::Squeezed>;
+
 // function to filter the query
 string filter_string(const string& text){
     string filter;
@@ -34,17 +63,16 @@ vector<string> split_string(const string& text){
 }
 
 string read_file_content(const string& file_path) {
-    ifstream file(file_path);
-    if (!file.is_open()) {
+    MappedFile file(file_path);
+    if (!file.isOpen()) {
         cerr << "Error: Could not open file " << file_path << endl;
         return "";
     }
-    
-    stringstream buffer;
-    buffer << file.rdbuf();  // Read the whole file content into a stringstream
-    return buffer.str();
+    return string(file.view());  // One copy straight out of the mapping
 }
 
+// Reference path: re-reads and re-splits every file for each query. Only used
+// by --compare to measure the index against it.
 vector<pair<string, int>> query_documents(const string& query, const vector<string>& filePaths){
     vector<string> query_keywords = split_string(filter_string(query));
     vector<pair<string, int>> doc_scores;
@@ -75,34 +103,908 @@ vector<pair<string, int>> query_documents(const string& query, const vector<stri
 
 }
 
-void display_Ranked_DOCS(const vector<pair<string, int>>& ranked_docs){
+// LZ77 compression of one store block in the spirit of LZ4. Each sequence is a
+// token byte (literal count in the high nibble, match length minus 4 in the low
+// one; 15 means length bytes follow, each adding up to 255), the literals, then
+// a 2-byte little-endian distance back to the match. The last sequence carries
+// only literals. A block that would not shrink is returned as is, so a block is
+// compressed exactly when it is stored smaller than its raw size.
+string compress_block(string_view in){
+    const int HASH_BITS = 14;
+    if(in.size() < 16){
+        return string(in);
+    }
+    auto put_length = [](string& out, size_t length){
+        for(; length >= 255; length -= 255){
+            out += static_cast<char>(255);
+        }
+        out += static_cast<char>(length);
+    };
+    auto put_sequence = [&](string& out, string_view literals, size_t match_length, size_t distance){
+        size_t extra = match_length >= 4 ? match_length - 4 : 0;
+        out += static_cast<char>(min<size_t>(literals.size(), 15) << 4 | min<size_t>(extra, 15));
+        if(literals.size() >= 15){
+            put_length(out, literals.size() - 15);
+        }
+        out.append(literals);
+        if(match_length >= 4){
+            out += static_cast<char>(distance & 0xFF);
+            out += static_cast<char>(distance >> 8);
+            if(extra >= 15){
+                put_length(out, extra - 15);
+            }
+        }
+    };
+
+    string out;
+    out.reserve(in.size());
+    vector<int> table(1 << HASH_BITS, -1);  // hash of 4 bytes -> last position they were seen at
+    size_t limit = in.size() - 5;  // the last bytes are always literals
+    size_t anchor = 0, pos = 0;
+    while(pos + 4 <= limit){
+        uint32_t sequence;
+        memcpy(&sequence, in.data() + pos, 4);
+        uint32_t hash = (sequence * 2654435761u) >> (32 - HASH_BITS);
+        int candidate = table[hash];
+        table[hash] = static_cast<int>(pos);
+        if(candidate < 0 || pos - candidate > 0xFFFF || memcmp(in.data() + candidate, in.data() + pos, 4) != 0){
+            pos++;
+            continue;
+        }
+        size_t length = 4;
+        while(pos + length < limit && in[candidate + length] == in[pos + length]){
+            length++;
+        }
+        put_sequence(out, in.substr(anchor, pos - anchor), length, pos - candidate);
+        pos += length;
+        anchor = pos;
+        if(out.size() >= in.size()){
+            return string(in);
+        }
+    }
+    put_sequence(out, in.substr(anchor), 0, 0);
+    return out.size() < in.size() ? out : string(in);
+}
+
+// Inverse of compress_block for a block known to hold raw_size bytes; returns
+// false when the input is not a well-formed block of that size
+bool decompress_block(string_view in, char* out, size_t raw_size){
+    if(in.size() == raw_size){
+        memcpy(out, in.data(), raw_size);
+        return true;
+    }
+    size_t ip = 0, op = 0;
+    auto get_length = [&](size_t length){
+        unsigned char byte;
+        do{
+            byte = ip < in.size() ? static_cast<unsigned char>(in[ip++]) : 0;
+            length += byte;
+        } while(byte == 255);
+        return length;
+    };
+    while(ip < in.size()){
+        unsigned char token = static_cast<unsigned char>(in[ip++]);
+        size_t literals = token >> 4;
+        if(literals == 15){
+            literals = get_length(literals);
+        }
+        if(literals > in.size() - ip || literals > raw_size - op){
+            return false;
+        }
+        // Short copies move a fixed 16 bytes when there is room; the excess is overwritten later
+        if(literals <= 16 && ip + 16 <= in.size() && op + 16 <= raw_size){
+            memcpy(out + op, in.data() + ip, 16);
+        }
+        else{
+            memcpy(out + op, in.data() + ip, literals);
+        }
+        ip += literals;
+        op += literals;
+        if(ip == in.size()){
+            break;
+        }
+        if(ip + 2 > in.size()){
+            return false;
+        }
+        size_t distance = static_cast<unsigned char>(in[ip]) | static_cast<unsigned char>(in[ip + 1]) << 8;
+        ip += 2;
+        size_t length = token & 15;
+        if(length == 15){
+            length = get_length(length);
+        }
+        length += 4;
+        if(distance == 0 || distance > op || length > raw_size - op){
+            return false;
+        }
+        if(distance >= 16 && length <= 16 && op + 16 <= raw_size){
+            memcpy(out + op, out + op - distance, 16);
+            op += length;
+        }
+        else if(distance >= length){
+            memcpy(out + op, out + op - distance, length);
+            op += length;
+        }
+        else{
+            for(size_t i = 0; i < length; i++, op++){
+                out[op] = out[op - distance];  // byte by byte, since the match overlaps itself
+            }
+        }
+    }
+    return op == raw_size;
+}
+
+// Compressed copy of every document's text. Each document is cut into 64 KB
+// blocks that are compressed on their own and appended to a store file, with an
+// offset table giving where each block starts. Any run of a document's blocks is
+// one contiguous range of the file, so a snippet costs one random read however
+// the document is laid out. The file is created in the temporary directory with
+// mkstemp and unlinked at once, so nothing is left behind however the process
+// ends; it is mapped once the index is built.
+class Document_Store{
+public:
+    static constexpr size_t BLOCK_SIZE = 1 << 16;
+    static constexpr size_t REGIONS = 16;  // a document is split into at most this many regions of whole blocks
+
+    vector<string> names;
+
+    Document_Store(){
+#ifndef _WIN32
+        string path = (fs::temp_directory_path() / "Assignment2-XXXXXX").string();
+        int fd = mkstemp(&path[0]);
+        if(fd >= 0){
+            unlink(path.c_str());
+            writer.reset(fdopen(fd, "w+b"));
+            if(!writer){
+                close(fd);
+            }
+        }
+#else
+        writer.reset(tmpfile());  // removed when it is closed
+#endif
+        if(!writer){
+            cerr << "Error: Could not create document store: " << strerror(errno) << endl;
+        }
+        first_block.push_back(0);
+        block_offsets.push_back(0);
+    }
+
+    // Compresses and appends a document's text; returns its id
+    int add(const string& name, string_view text){
+        names.push_back(name);
+        lengths.push_back(text.size());
+        for(size_t offset = 0; offset < text.size(); offset += BLOCK_SIZE){
+            string block = compress_block(text.substr(offset, BLOCK_SIZE));
+            if(writer){
+                fwrite(block.data(), 1, block.size(), writer.get());
+            }
+            block_offsets.push_back(block_offsets.back() + block.size());
+        }
+        first_block.push_back(static_cast<uint32_t>(block_offsets.size() - 1));
+        return static_cast<int>(names.size() - 1);
+    }
+
+    // Ends writing; the store is read through a mapping from here on
+    void finish(){
+        if(writer){
+            store = make_unique<MappedFile>(writer.get());
+            writer.reset();  // a mapping outlives the descriptor it was made from
+        }
+    }
+
+    // Regions are whole numbers of blocks, as few as keep a document within REGIONS of them
+    size_t region_bytes(int doc_id) const{
+        size_t blocks = first_block[doc_id + 1] - first_block[doc_id];
+        return max<size_t>(1, (blocks + REGIONS - 1) / REGIONS) * BLOCK_SIZE;
+    }
+
+    size_t region_of(int doc_id, size_t offset) const{
+        return min(REGIONS - 1, offset / region_bytes(doc_id));
+    }
+
+    // Text of a region plus the block on either side of it, so words crossing its
+    // edges are whole; start is set to the offset of that text in the document
+    string read_region(int doc_id, size_t region, size_t& start) const{
+        size_t blocks = first_block[doc_id + 1] - first_block[doc_id];
+        size_t per_region = region_bytes(doc_id) / BLOCK_SIZE;
+        size_t first = min(blocks, region * per_region), last = min(blocks, first + per_region + 1);
+        if(first > 0){
+            first--;
+        }
+        start = first * BLOCK_SIZE;
+        string text(min<uint64_t>(lengths[doc_id], last * BLOCK_SIZE) - start, '\0');
+        if(!store || !store->isOpen()){
+            return "";
+        }
+        string_view stored = store->view();
+        for(size_t block = first; block < last; block++){
+            uint64_t from = block_offsets[first_block[doc_id] + block], to = block_offsets[first_block[doc_id] + block + 1];
+            size_t raw_size = min<uint64_t>(BLOCK_SIZE, lengths[doc_id] - block * BLOCK_SIZE);
+            if(to > stored.size() || !decompress_block(stored.substr(from, to - from), &text[(block - first) * BLOCK_SIZE], raw_size)){
+                return "";
+            }
+        }
+        return text;
+    }
+
+    uint64_t length(int doc_id) const{ return lengths[doc_id]; }
+    uint64_t stored_bytes() const{ return block_offsets.back(); }
+
+private:
+    vector<uint64_t> lengths;        // raw length of each document
+    vector<uint32_t> first_block;    // document -> its first block, with one entry past the last document
+    vector<uint64_t> block_offsets;  // block -> where it starts in the store, with one entry past the last block
+    struct File_Closer{
+        void operator()(FILE* file) const{ fclose(file); }
+    };
+    unique_ptr<FILE, File_Closer> writer;  // the store while it is written
+    unique_ptr<MappedFile> store;
+};
+
+// keyword id -> ids of the documents containing it, in increasing id order. Each
+// posting also has a mask of the store regions of its document the keyword
+// occurs in (bit r for region r), which is all a snippet needs to know where to read.
+struct Inverted_Index{
+    Vocabulary vocabulary;
+    vector<vector<int>> postings;
+    vector<vector<uint16_t>> regions;  // parallel to postings; Document_Store::REGIONS bits each
+    Document_Store docs;
+};
+
+Inverted_Index build_index(const vector<string>& filePaths){
+    Inverted_Index index;
+    for(const auto& filePath : filePaths){
+        MappedFile file(filePath);
+        if(!file.isOpen()){
+            cerr << "Error: Could not open file " << filePath << endl;
+        }
+        int doc_id = index.docs.add(fs::path(filePath).filename().string(), file.view());
+
+        ChunkedTokens keywords(file.view());
+        string_view keyword;
+        while(keywords.next(keyword)){
+            uint32_t keyword_id = index.vocabulary.intern(keyword);
+            if(keyword_id == index.postings.size()){
+                index.postings.emplace_back();
+                index.regions.emplace_back();
+            }
+            // Postings are in id order, so a repeat within this document is at the back
+            vector<int>& docs = index.postings[keyword_id];
+            if(docs.empty() || docs.back() != doc_id){
+                docs.push_back(doc_id);
+                index.regions[keyword_id].push_back(0);
+            }
+            index.regions[keyword_id].back() |= 1 << index.docs.region_of(doc_id, keywords.offsetOf(keyword));
+        }
+    }
+    index.docs.finish();
+    return index;
+}
+
+// Scores only the documents on the postings of the query keywords, so the cost
+// of a query depends on how common its keywords are rather than on corpus size.
+// Like query_documents, a keyword repeated in the query counts every time.
+vector<pair<int, int>> query_index(const Inverted_Index& index, const string& query){
+    unordered_map<int, int> scores;
+    string buffer = query;
+    TokenStream keywords(buffer.data(), buffer.size());
+    string_view keyword;
+    while(keywords.next(keyword)){
+        uint32_t keyword_id = index.vocabulary.find(keyword);
+        if(keyword_id == Vocabulary::NOT_FOUND){
+            continue;
+        }
+        for(int doc_id : index.postings[keyword_id]){
+            scores[doc_id]++;
+        }
+    }
+
+    vector<pair<int, int>> doc_scores(scores.begin(), scores.end());
+    sort(doc_scores.begin(), doc_scores.end(), [](const pair<int, int>& a, const pair<int, int>& b){
+        return a.second != b.second ? b.second < a.second : a.first < b.first;
+    });
+    return doc_scores;
+}
+
+// Ids of the query's keywords, normalised like the documents
+vector<uint32_t> query_keyword_ids(const Vocabulary& vocabulary, const string& query){
+    vector<uint32_t> keyword_ids;
+    string buffer = query;
+    TokenStream keywords(buffer.data(), buffer.size());
+    string_view keyword;
+    while(keywords.next(keyword)){
+        keyword_ids.push_back(vocabulary.find(keyword));
+    }
+    return keyword_ids;
+}
+
+// Best window of a document for the query keywords, at most SNIPPET_WORDS words
+// and SNIPPET_BYTES bytes, with the keywords in [brackets]. The region holding
+// the most distinct keywords is picked from the postings' region masks, so only
+// that region's blocks are read and decompressed; within it the window with the
+// most distinct keywords wins, ties going to more occurrences and then the first.
+string make_snippet(const Inverted_Index& index, int doc_id, const vector<uint32_t>& keyword_ids){
+    const size_t SNIPPET_WORDS = 30, SNIPPET_BYTES = 300, CONTEXT_WORDS = 4;
+
+    vector<uint32_t> keywords;  // the distinct query keywords in this document; a hit's bit is its slot here
+    size_t region_counts[Document_Store::REGIONS] = {};
+    for(uint32_t keyword_id : keyword_ids){
+        if(keyword_id == Vocabulary::NOT_FOUND || keywords.size() == 64 ||
+           find(keywords.begin(), keywords.end(), keyword_id) != keywords.end()){
+            continue;
+        }
+        const vector<int>& docs = index.postings[keyword_id];
+        auto it = lower_bound(docs.begin(), docs.end(), doc_id);
+        if(it == docs.end() || *it != doc_id){
+            continue;
+        }
+        keywords.push_back(keyword_id);
+        unsigned mask = index.regions[keyword_id][it - docs.begin()];
+        for(size_t region = 0; region < Document_Store::REGIONS; region++){
+            region_counts[region] += mask >> region & 1;
+        }
+    }
+    size_t best_region = max_element(region_counts, region_counts + Document_Store::REGIONS) - region_counts;
+
+    size_t start;
+    string text = index.docs.read_region(doc_id, best_region, start);
+    bool cut_off = start + text.size() < index.docs.length(doc_id);  // the text stops inside the document
+
+    // Words are split and normalised as TokenStream does: whitespace-separated,
+    // lowercased, non-alphanumerics dropped. A hit is a word equal to a keyword;
+    // words made only of punctuation are not kept.
+    static const array<char, 256> normal_form = []{
+        array<char, 256> table{};  // 0 for bytes dropped from words
+        for(int c = '0'; c <= '9'; c++){
+            table[c] = static_cast<char>(c);
+        }
+        for(int c = 'a'; c <= 'z'; c++){
+            table[c] = static_cast<char>(c);
+            table[c - 32] = static_cast<char>(c);
+        }
+        return table;
+    }();
+    struct Word{ size_t begin; int slot; };
+    vector<Word> words;
+    vector<size_t> hits;  // indexes into words
+    string normal;
+    for(size_t pos = 0; pos < text.size();){
+        while(pos < text.size() && isTokenSpace(text[pos])){
+            pos++;
+        }
+        size_t begin = pos;
+        bool plain = true;  // already lowercase alphanumeric, so it is its own normal form
+        for(; pos < text.size() && !isTokenSpace(text[pos]); pos++){
+            plain &= normal_form[static_cast<unsigned char>(text[pos])] == text[pos];
+        }
+        string_view word(text.data() + begin, pos - begin);
+        if(!plain){
+            normal.clear();
+            for(char ch : word){
+                if(char c = normal_form[static_cast<unsigned char>(ch)]){
+                    normal += c;
+                }
+            }
+            word = normal;
+        }
+        if(word.empty() || (begin == 0 && start > 0)){
+            continue;  // punctuation, or the tail of a word cut by the first block
+        }
+        // A word running into the end of cut-off text may be cut too, so it is never a hit
+        int slot = -1;
+        for(size_t k = 0; k < keywords.size() && slot < 0 && !(cut_off && pos == text.size()); k++){
+            if(index.vocabulary.term(keywords[k]) == word){
+                slot = static_cast<int>(k);
+            }
+        }
+        if(slot >= 0){
+            hits.push_back(words.size());
+        }
+        words.push_back({begin, slot});
+    }
+    if(words.empty()){
+        return "";
+    }
+
+    size_t first_word = 0;
+    int best_distinct = 0;
+    size_t best_count = 0;
+    // Sliding window over the hits: hits[i, j) are those within reach of hits[i]
+    size_t slot_counts[64] = {};
+    int distinct = 0;
+    for(size_t i = 0, j = 0; i < hits.size(); i++){
+        while(j < hits.size() && hits[j] - hits[i] < SNIPPET_WORDS - CONTEXT_WORDS){
+            distinct += slot_counts[words[hits[j++]].slot]++ == 0;
+        }
+        if(distinct > best_distinct || (distinct == best_distinct && j - i > best_count)){
+            best_distinct = distinct;
+            best_count = j - i;
+            first_word = hits[i] > CONTEXT_WORDS ? hits[i] - CONTEXT_WORDS : 0;
+        }
+        distinct -= --slot_counts[words[hits[i]].slot] == 0;
+    }
+
+    // The words are copied from the text with the punctuation between them and
+    // each run of whitespace turned into one space
+    string snippet = first_word > 0 || start > 0 ? "..." : "";
+    size_t w = first_word, previous_end = words[first_word].begin;
+    string gap;
+    for(; w < words.size() && w < first_word + SNIPPET_WORDS; w++){
+        size_t begin = words[w].begin, end = begin;
+        while(end < text.size() && !isTokenSpace(text[end])){
+            end++;
+        }
+        gap.clear();
+        for(size_t i = previous_end; i < begin; i++){
+            if(!isTokenSpace(text[i])){
+                gap += text[i];
+            }
+            else if(gap.empty() || gap.back() != ' '){
+                gap += ' ';
+            }
+        }
+        // Room for the word once its brackets and a closing "..." are counted
+        size_t used = snippet.size() + gap.size() + (words[w].slot >= 0 ? 2 : 0) + 3;
+        size_t room = SNIPPET_BYTES > used ? SNIPPET_BYTES - used : 0;
+        if(w > first_word && end - begin > room){
+            break;
+        }
+        snippet += gap;
+        if(words[w].slot >= 0){
+            snippet += '[';
+        }
+        snippet.append(text, begin, min(end - begin, room));
+        if(words[w].slot >= 0){
+            snippet += ']';
+        }
+        previous_end = end;
+    }
+    if(w < words.size() || start + text.size() < index.docs.length(doc_id)){
+        snippet += "...";
+    }
+    return snippet;
+}
+
+void display_Ranked_DOCS(const vector<pair<int, int>>& ranked_docs, const Inverted_Index& index, const vector<uint32_t>& keyword_ids){
+    const Document_Store& docs = index.docs;
     cout << "Ranked Documents based on keyword matching:\n" << endl;
-    for (const auto& [title, score] : ranked_docs) {
-        if (score > 0) {
-            cout << title << " (Matched Keywords: " << score << ")" << endl;
-            string doc_content = read_file_content(title);
-            cout<<"Content: " << doc_content <<endl;
-        } 
-        else {
-            cout << title << ": No matching keywords." << endl;
+    for (const auto& [doc_id, score] : ranked_docs) {
+        cout << docs.names[doc_id] << " (Matched Keywords: " << score << ")" << endl;
+        cout<<"Snippet: " << make_snippet(index, doc_id, keyword_ids) <<endl;
+        cout << endl;
+    }
+    size_t unmatched = docs.names.size() - ranked_docs.size();
+    if (ranked_docs.empty()) {
+        cout << "No documents match your query." << endl;
+    }
+    else if (unmatched > 0) {
+        cout << unmatched << " other document(s) had no matching keywords." << endl;
+    }
+}
+
+// Boolean queries: keywords combined with AND, OR, NOT and parentheses. The
+// operators must be written in capitals; adjacent operands are ANDed. A keyword
+// with nothing left once normalised (such as "--") is dropped from the query.
+struct Query_Node{
+    enum Kind{ KEYWORD, AND, OR, NOT, EMPTY } kind;  // EMPTY: dropped, never left in a parsed query
+    uint32_t keyword_id = Vocabulary::NOT_FOUND;  // KEYWORD only; NOT_FOUND matches nothing
+    vector<Query_Node> children;
+
+    explicit Query_Node(Kind kind) : kind(kind) {}
+};
+
+bool is_boolean_query(const string& query){
+    if(query.find_first_of("()") != string::npos){
+        return true;
+    }
+    for(const string& word : split_string(query)){
+        if(word == "AND" || word == "OR" || word == "NOT"){
+            return true;
+        }
+    }
+    return false;
+}
+
+// Recursive descent over:  or := and (OR and)*   and := not (AND? not)*
+//                          not := NOT not | ( or ) | keyword
+class Boolean_Parser{
+public:
+    Boolean_Parser(const string& query, const Vocabulary& vocabulary) : vocabulary(vocabulary){
+        string spaced;
+        for(char ch : query){
+            if(ch == '(' || ch == ')'){
+                spaced += ' ';
+                spaced += ch;
+                spaced += ' ';
+            }
+            else{
+                spaced += ch;
+            }
+        }
+        words = split_string(spaced);
+    }
+
+    Query_Node parse(){
+        Query_Node root = parse_or();
+        if(pos != words.size()){
+            throw runtime_error("unexpected '" + words[pos] + "'");
+        }
+        if(root.kind == Query_Node::EMPTY){
+            throw runtime_error("no keyword has a letter or digit");
+        }
+        return root;
+    }
+
+    // Keywords parse() left out because they have no letters or digits
+    const vector<string>& dropped_keywords() const{ return dropped; }
+
+private:
+    const Vocabulary& vocabulary;
+    vector<string> words;
+    vector<string> dropped;
+    size_t pos = 0;
+
+    static void add_operand(Query_Node& node, Query_Node operand){
+        if(operand.kind != Query_Node::EMPTY){
+            node.children.push_back(move(operand));
+        }
+    }
+
+    // An AND or OR of one operand is that operand, and of none is dropped too
+    static Query_Node collapse(Query_Node& node){
+        if(node.children.empty()){
+            return Query_Node(Query_Node::EMPTY);
+        }
+        return node.children.size() == 1 ? move(node.children[0]) : move(node);
+    }
+
+    bool accept(const string& word){
+        if(pos < words.size() && words[pos] == word){
+            pos++;
+            return true;
+        }
+        return false;
+    }
+
+    Query_Node parse_or(){
+        Query_Node node{Query_Node::OR};
+        add_operand(node, parse_and());
+        while(accept("OR")){
+            add_operand(node, parse_and());
+        }
+        return collapse(node);
+    }
+
+    Query_Node parse_and(){
+        Query_Node node{Query_Node::AND};
+        add_operand(node, parse_not());
+        while(pos < words.size() && words[pos] != "OR" && words[pos] != ")"){
+            accept("AND");
+            add_operand(node, parse_not());
+        }
+        return collapse(node);
+    }
+
+    Query_Node parse_not(){
+        if(pos == words.size()){
+            throw runtime_error("query ends where a keyword was expected");
+        }
+        if(accept("NOT")){
+            Query_Node operand = parse_not();
+            if(operand.kind == Query_Node::EMPTY){
+                return operand;
+            }
+            Query_Node node{Query_Node::NOT};
+            node.children.push_back(move(operand));
+            return node;
+        }
+        if(accept("(")){
+            Query_Node node = parse_or();
+            if(!accept(")")){
+                throw runtime_error("missing ')'");
+            }
+            return node;
+        }
+        if(words[pos] == ")" || words[pos] == "AND" || words[pos] == "OR"){
+            throw runtime_error("unexpected '" + words[pos] + "'");
+        }
+        // Keywords are normalised like the documents: lowercased, non-alphanumerics dropped
+        string keyword = filter_string(words[pos++]);
+        if(keyword.empty()){
+            dropped.push_back(words[pos - 1]);
+            return Query_Node(Query_Node::EMPTY);
+        }
+        Query_Node node{Query_Node::KEYWORD};
+        node.keyword_id = vocabulary.find(keyword);
+        return node;
+    }
+};
+
+// First index at or after from whose document is >= target. The probe distance
+// doubles until it passes target, so skipping n entries costs O(log n).
+size_t gallop(const vector<int>& docs, size_t from, int target){
+    size_t step = 1, high = from;
+    while(high < docs.size() && docs[high] < target){
+        from = high + 1;
+        high += step;
+        step *= 2;
+    }
+    return lower_bound(docs.begin() + from, docs.begin() + min(high, docs.size()), target) - docs.begin();
+}
+
+// Merge intersection of two lists of similar length. With SSE2 it compares 4x4
+// blocks at a time: the block of b is rotated three times so every pair is
+// compared, and whichever block ends first is advanced (both on a tie).
+vector<int> intersect_merge(const vector<int>& a, const vector<int>& b){
+    vector<int> result;
+    size_t i = 0, j = 0;
+#if defined(__SSE2__)
+    while(i + 4 <= a.size() && j + 4 <= b.size()){
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a.data() + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b.data() + j));
+        __m128i equal = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi32(va, vb), _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(0, 3, 2, 1)))),
+            _mm_or_si128(_mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(1, 0, 3, 2))),
+                         _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(2, 1, 0, 3)))));
+        int matches = _mm_movemask_ps(_mm_castsi128_ps(equal));
+        for(int lane = 0; lane < 4; lane++){
+            if(matches & (1 << lane)){
+                result.push_back(a[i + lane]);
+            }
+        }
+        int a_last = a[i + 3], b_last = b[j + 3];
+        if(a_last <= b_last){
+            i += 4;
+        }
+        if(b_last <= a_last){
+            j += 4;
+        }
+    }
+#endif
+    while(i < a.size() && j < b.size()){
+        if(a[i] < b[j]){
+            i++;
+        }
+        else if(b[j] < a[i]){
+            j++;
+        }
+        else{
+            result.push_back(a[i]);
+            i++;
+            j++;
+        }
+    }
+    return result;
+}
+
+// Intersection in time proportional to the shorter list: gallops through the
+// longer one when the lengths differ a lot, merges block-wise otherwise
+vector<int> intersect(const vector<int>& shorter, const vector<int>& longer){
+    if(longer.size() < shorter.size() * 16){
+        return intersect_merge(shorter, longer);
+    }
+    vector<int> result;
+    size_t pos = 0;
+    for(int doc_id : shorter){
+        pos = gallop(longer, pos, doc_id);
+        if(pos == longer.size()){
+            break;
+        }
+        if(longer[pos] == doc_id){
+            result.push_back(doc_id);
+        }
+    }
+    return result;
+}
+
+// Documents of docs that are not in excluded
+vector<int> subtract(const vector<int>& docs, const vector<int>& excluded){
+    vector<int> result;
+    size_t pos = 0;
+    for(int doc_id : docs){
+        pos = gallop(excluded, pos, doc_id);
+        if(pos == excluded.size() || excluded[pos] != doc_id){
+            result.push_back(doc_id);
+        }
+    }
+    return result;
+}
+
+// Evaluates a query to the increasing ids of the documents matching it. Keyword
+// lists are used in place; an AND intersects its positive operands from the
+// shortest up, then removes its NOT operands, so it never costs more than a walk
+// of its shortest list plus logarithmic skips through the others.
+vector<int> evaluate_boolean(const Inverted_Index& index, const Query_Node& node){
+    static const vector<int> no_docs;
+    auto keyword_docs = [&](const Query_Node& keyword) -> const vector<int>&{
+        return keyword.keyword_id == Vocabulary::NOT_FOUND ? no_docs : index.postings[keyword.keyword_id];
+    };
+
+    if(node.kind == Query_Node::KEYWORD){
+        return keyword_docs(node);
+    }
+    if(node.kind == Query_Node::NOT){
+        vector<int> all_docs(index.docs.names.size());
+        for(size_t doc_id = 0; doc_id < all_docs.size(); doc_id++){
+            all_docs[doc_id] = static_cast<int>(doc_id);
+        }
+        return subtract(all_docs, evaluate_boolean(index, node.children[0]));
+    }
+    if(node.kind == Query_Node::OR){
+        vector<int> result, merged;
+        for(const Query_Node& child : node.children){
+            vector<int> evaluated;
+            if(child.kind != Query_Node::KEYWORD){
+                evaluated = evaluate_boolean(index, child);
+            }
+            const vector<int>& docs = child.kind == Query_Node::KEYWORD ? keyword_docs(child) : evaluated;
+            merged.clear();
+            set_union(result.begin(), result.end(), docs.begin(), docs.end(), back_inserter(merged));
+            result.swap(merged);
+        }
+        return result;
+    }
+
+    // AND: evaluate the operands that are not plain keywords, then order all by length
+    deque<vector<int>> evaluated;
+    vector<const vector<int>*> included, excluded;
+    for(const Query_Node& child : node.children){
+        bool negated = child.kind == Query_Node::NOT;
+        const Query_Node& operand = negated ? child.children[0] : child;
+        const vector<int>* docs;
+        if(operand.kind == Query_Node::KEYWORD){
+            docs = &keyword_docs(operand);
+        }
+        else{
+            evaluated.push_back(evaluate_boolean(index, operand));
+            docs = &evaluated.back();
+        }
+        (negated ? excluded : included).push_back(docs);
+    }
+    if(included.empty()){
+        Query_Node complement{Query_Node::NOT};
+        complement.children.push_back(Query_Node(Query_Node::OR));
+        for(const Query_Node& child : node.children){
+            complement.children[0].children.push_back(child.children[0]);
         }
+        return evaluate_boolean(index, complement);
+    }
+    auto by_length = [](const vector<int>* a, const vector<int>* b){ return a->size() < b->size(); };
+    sort(included.begin(), included.end(), by_length);
+
+    vector<int> result = *included[0];
+    for(size_t i = 1; i < included.size() && !result.empty(); i++){
+        result = intersect(result, *included[i]);
+    }
+    for(const vector<int>* docs : excluded){
+        result = subtract(result, *docs);
+    }
+    return result;
+}
+
+// Keyword ids a Boolean query asks to be present, i.e. those not under a NOT,
+// which are the ones worth highlighting
+void collect_keywords(const Query_Node& node, vector<uint32_t>& keyword_ids){
+    if(node.kind == Query_Node::KEYWORD){
+        keyword_ids.push_back(node.keyword_id);
+    }
+    else if(node.kind != Query_Node::NOT){
+        for(const Query_Node& child : node.children){
+            collect_keywords(child, keyword_ids);
+        }
+    }
+}
+
+void display_Boolean_DOCS(const vector<int>& doc_ids, const Inverted_Index& index, const Query_Node& query){
+    const Document_Store& docs = index.docs;
+    vector<uint32_t> keyword_ids;
+    collect_keywords(query, keyword_ids);
+    cout << "Documents matching the Boolean query:\n" << endl;
+    for(int doc_id : doc_ids){
+        cout << docs.names[doc_id] << endl;
+        cout << "Snippet: " << make_snippet(index, doc_id, keyword_ids) << endl;
         cout << endl;
     }
-    // if (ranked_docs.empty()) {
-    //     cout << "No documents match your query." << endl;
-    //     return;
-    // }
+    if(doc_ids.empty()){
+        cout << "No documents match your query." << endl;
+    }
+    else{
+        cout << doc_ids.size() << " of " << docs.names.size() << " document(s) matched." << endl;
+    }
+}
+
+// Round trip of compress_block and decompress_block on the edge cases of the
+// store: an empty block, an incompressible one (which must be kept as is) and
+// highly repetitive ones (which must shrink to a small fraction)
+bool check_block_round_trip(){
+    mt19937 random_bytes(42);
+    string noise(Document_Store::BLOCK_SIZE, '\0');
+    for(char& c : noise){
+        c = static_cast<char>(random_bytes());
+    }
+    string period;
+    for(size_t i = 0; i < Document_Store::BLOCK_SIZE; i++){
+        period += "abc"[i % 3];
+    }
+    const vector<pair<string, string>> cases = {
+        {"empty", ""},
+        {"short", "abcabcabc"},
+        {"incompressible", noise},
+        {"one byte repeated", string(Document_Store::BLOCK_SIZE, 'a')},
+        {"short period", period},
+    };
+    bool ok = true;
+    for(const auto& [name, raw] : cases){
+        string packed = compress_block(raw);
+        string unpacked(raw.size(), '\0');
+        bool fits = name == "incompressible" ? packed == raw
+                  : raw.size() < 1024 || packed.size() * 100 < raw.size();
+        if(!fits || !decompress_block(packed, unpacked.data(), raw.size()) || unpacked != raw){
+            cout << "Block round trip failed: " << name << " (" << raw.size() << " -> " << packed.size() << " bytes)" << endl;
+            ok = false;
+        }
+    }
+    cout << "Block round trip: " << (ok ? "ok" : "FAILED") << "\n" << endl;
+    return ok;
+}
+
+// Times the reference scan against the index for the same query
+void compare_latency(const string& query, const vector<string>& filePaths, const Inverted_Index& index){
+    const int runs = 20;
+    auto start = chrono::steady_clock::now();
+    for(int i = 0; i < runs; i++){
+        query_documents(query, filePaths);
+    }
+    auto middle = chrono::steady_clock::now();
+    for(int i = 0; i < runs; i++){
+        query_index(index, query);
+    }
+    auto end = chrono::steady_clock::now();
+
+    double scan_ms = chrono::duration<double, milli>(middle - start).count() / runs;
+    double index_ms = chrono::duration<double, milli>(end - middle).count() / runs;
+    cout << "Scan: " << scan_ms << " ms/query, Index: " << index_ms << " ms/query";
+    if(index_ms > 0){
+        cout << " (" << scan_ms / index_ms << "x faster)";
+    }
+    cout << "\n" << endl;
+}
+
+// Times building the index, then ranking every line of query_file with query_index
+void benchmark_queries(const vector<string>& filePaths, const string& query_file){
+    uint64_t bytes = 0;
+    for(const auto& filePath : filePaths){
+        bytes += fs::file_size(filePath);
+    }
+    auto start = chrono::steady_clock::now();
+    Inverted_Index index = build_index(filePaths);
+    reportIndexing(filePaths.size(), bytes, chrono::duration<double>(chrono::steady_clock::now() - start).count());
 
-    // cout << "Ranked Documents based on keyword matching:\n" << endl;
-    // for (const auto& [title, score] : ranked_docs) {
-    //     cout << title << " (Matched Keywords: " << score << ")" << endl;
-    //     cout << endl;
-    // }
+    vector<string> lines = readBenchQueries(query_file);
+    size_t matches = 0;
+    timeQueries("keyword_index", lines, [&](const string& line){
+        matches += query_index(index, line).size();
+    });
+    cout << "Ranked " << lines.size() << " queries, " << matches << " matching documents" << endl;
+
+    // The same ranking plus a snippet for each of the top 10 documents
+    size_t snippet_bytes = 0;
+    timeQueries("snippets", lines, [&](const string& line){
+        vector<pair<int, int>> ranked = query_index(index, line);
+        vector<uint32_t> keyword_ids = query_keyword_ids(index.vocabulary, line);
+        for(size_t i = 0; i < ranked.size() && i < 10; i++){
+            snippet_bytes += make_snippet(index, ranked[i].first, keyword_ids).size();
+        }
+    });
+    cout << "Stored " << bytes << " bytes in " << index.docs.stored_bytes() << ", " << snippet_bytes << " bytes of snippets" << endl;
 }
 
-int main()
+int main(int argc, char* argv[])
 {
     string folder_Path = "./";
+    if(argc == 3 && string(argv[1]) == "--bench-tokenizer"){
+        benchmarkTokenizer<TokenRule::Squeezed>(argv[2]);
+        return 0;
+    }
     
     vector<string> filePaths;
     for(const auto& entry : fs::directory_iterator(folder_Path)){
@@ -116,11 +1018,45 @@ int main()
         return 1;
     }
 
+    if(argc == 3 && string(argv[1]) == "--bench-queries"){
+        benchmark_queries(filePaths, argv[2]);
+        return 0;
+    }
+
+    // --compare also checks the block compressor and reports the latency of the
+    // old per-query scan
+    bool compare = argc > 1 && string(argv[1]) == "--compare";
+    if(compare){
+        check_block_round_trip();
+    }
+    Inverted_Index index = build_index(filePaths);
+
     string user_query;
-    cout<<"Enter Your Query:";
-    getline(cin, user_query);
-    vector<pair<string, int>> ranked_documents = query_documents(user_query, filePaths);
-    display_Ranked_DOCS(ranked_documents);
+    while(true){
+        cout<<"Enter Your Query (empty line to quit):";
+        if(!getline(cin, user_query) || user_query.empty()){
+            break;
+        }
+        if(is_boolean_query(user_query)){
+            try{
+                Boolean_Parser parser(user_query, index.vocabulary);
+                Query_Node query = parser.parse();
+                for(const string& keyword : parser.dropped_keywords()){
+                    cout << "Ignoring \"" << keyword << "\": it has no letters or digits" << endl;
+                }
+                display_Boolean_DOCS(evaluate_boolean(index, query), index, query);
+            }
+            catch(const runtime_error& e){
+                cout << "Invalid Boolean query: " << e.what() << endl;
+            }
+            continue;
+        }
+        if(compare){
+            compare_latency(user_query, filePaths, index);
+        }
+        vector<pair<int, int>> ranked_documents = query_index(index, user_query);
+        display_Ranked_DOCS(ranked_documents, index, query_keyword_ids(index.vocabulary, user_query));
+    }
 
     return 0;
 }
\ No newline at end of file
@@ -5,71 +5,235 @@
 #include <algorithm>
 #include <unordered_set>
 #include <unordered_map>
-#include <queue>
 #include <filesystem>
 #include <fstream>
 #include <sstream>
 #include <limits>
+#include <functional>
+#include <string_view>
+#include <cstdint>
+#include <cstdlib>
+#include <chrono>
+#include <cmath>
+#include "../common/token_stream.h"
+#include "../common/result_cache.h"
+#include "../common/vocabulary.h"
+#include "../common/wand.h"
+#include "../common/bench_report.h"
 
 using namespace std;
 namespace fs = std::filesystem;
 
+// Lowercase alphanumeric words
+using TokenStream = BasicTokenStream<TokenRule::Alphanumeric>;
+using ChunkedTokens = BasicChunkedTokens<TokenRule::Alphanumeric>;
+
 // Function to tokenize a string into lowercase alphanumeric words
-vector<string> tokenize(const string& text) {
+vector<string> tokenize(string text) {
     vector<string> tokens;
-    string word = "";
-    for (char ch : text) {
-        if (isalnum(ch)) {
-            word += tolower(ch);
-        } else if (!word.empty()) {
-            tokens.push_back(word);
-            word.clear();
-        }
-    }
-    if (!word.empty()) tokens.push_back(word);
+    TokenStream stream(text.data(), text.size());
+    string_view token;
+    while (stream.next(token)) tokens.emplace_back(token);
     return tokens;
 }
 
-// Function to calculate the Jaccard similarity between two sets
-double calculateJaccard(const set<string>& docSet, const set<string>& querySet) {
-    set<string> intersectionSet, unionSet;
-    set_intersection(docSet.begin(), docSet.end(), querySet.begin(), querySet.end(), inserter(intersectionSet, intersectionSet.begin()));
-    set_union(docSet.begin(), docSet.end(), querySet.begin(), querySet.end(), inserter(unionSet, unionSet.begin()));
-    return static_cast<double>(intersectionSet.size()) / unionSet.size();
+// One entry of a term's postings list
+struct Posting {
+    int doc;
+    int tf;
+    int firstPosition;  // the tf word positions start here in the term's positions list
+};
+
+// Inverted index built once over the document collection and shared by all models
+struct InvertedIndex {
+    Vocabulary vocabulary;
+    vector<vector<Posting>> postings;  // term id -> postings in document order
+    vector<vector<int>> positions;     // term id -> word positions, grouped by posting and ascending
+    vector<int> distinctTerms;         // number of distinct terms per document
+    vector<int> documentLengths;       // number of words per document
+    double averageLength = 0.0;
+    int shortestLength = 0;
+    vector<double> idf;                // term id -> Robertson/Sparck Jones weight, see rsjWeight
+    vector<int> maxTermFrequency;      // term id -> largest tf in its postings
+};
+
+// Robertson/Sparck Jones relevance weight of a term found in df of n documents,
+// estimated without relevance information. The 1 added inside the logarithm keeps
+// it positive for terms in more than half of the documents, so every matching term
+// raises a score and the top-k search can bound what a term contributes.
+double rsjWeight(size_t n, size_t df) {
+    return log(1.0 + (n - df + 0.5) / (df + 0.5));
 }
 
-// BIM Retrieval Model
-vector<pair<string, double>> retrieveDocumentsBIM(const vector<pair<string, string>>& documents, const string& query) {
-    vector<pair<string, double>> scores;
+// Word positions of one term in one document
+struct PositionRange {
+    const int* first;
+    const int* last;
+
+    const int* begin() const { return first; }
+    const int* end() const { return last; }
+};
+
+PositionRange positionsOf(const InvertedIndex& index, uint32_t term, const Posting& posting) {
+    const int* first = index.positions[term].data() + posting.firstPosition;
+    return {first, first + posting.tf};
+}
+
+// Function to build the inverted index from the documents
+InvertedIndex buildIndex(const vector<pair<string, MappedFile>>& documents) {
+    InvertedIndex index;
+    vector<uint32_t> termIds;
+    for (size_t doc = 0; doc < documents.size(); ++doc) {
+        termIds.clear();
+        ChunkedTokens tokens(documents[doc].second.view());
+        string_view token;
+        while (tokens.next(token)) {
+            termIds.push_back(index.vocabulary.intern(token));
+        }
+        index.postings.resize(index.vocabulary.size());
+        index.positions.resize(index.vocabulary.size());
+
+        // A term's postings end with this document once it has been counted here.
+        // Documents are indexed one at a time, so each posting's positions are contiguous.
+        int distinct = 0;
+        for (size_t position = 0; position < termIds.size(); ++position) {
+            uint32_t id = termIds[position];
+            vector<Posting>& list = index.postings[id];
+            if (list.empty() || list.back().doc != static_cast<int>(doc)) {
+                list.push_back({static_cast<int>(doc), 0, static_cast<int>(index.positions[id].size())});
+                ++distinct;
+            }
+            ++list.back().tf;
+            index.positions[id].push_back(static_cast<int>(position));
+        }
+        index.distinctTerms.push_back(distinct);
+        index.documentLengths.push_back(static_cast<int>(termIds.size()));
+    }
+
+    // Collection statistics the probabilistic models need, computed once here so
+    // scoring a document is arithmetic on its postings
+    double totalLength = 0.0;
+    for (int length : index.documentLengths) totalLength += length;
+    if (!documents.empty()) {
+        index.averageLength = max(1.0, totalLength / documents.size());
+        index.shortestLength = *min_element(index.documentLengths.begin(), index.documentLengths.end());
+    }
+    for (const vector<Posting>& list : index.postings) {
+        index.idf.push_back(rsjWeight(documents.size(), list.size()));
+        int maxTf = 0;
+        for (const Posting& posting : list) maxTf = max(maxTf, posting.tf);
+        index.maxTermFrequency.push_back(maxTf);
+    }
+    return index;
+}
 
+// Function to map query tokens to the ids of the distinct ones; unknown terms are dropped
+vector<uint32_t> lookupTerms(const Vocabulary& vocabulary, const vector<string>& tokens) {
+    vector<uint32_t> ids;
+    for (const string& token : tokens) {
+        uint32_t id = vocabulary.find(token);
+        if (id != Vocabulary::NOT_FOUND) ids.push_back(id);
+    }
+    sort(ids.begin(), ids.end());
+    ids.erase(unique(ids.begin(), ids.end()), ids.end());
+    return ids;
+}
+
+using TermCursor = BasicTermCursor<Posting, double>;
+
+// Scores one document given the cursors positioned on it
+using DocumentScorer = function<double(int doc, const vector<const TermCursor*>& matched)>;
+
+// Probabilistic ranking models, all scored from the postings with the collection
+// statistics precomputed in the index:
+//   Bim      sum of the RSJ weights of the query terms the document contains
+//   Bm25     each matching term's RSJ weight scaled by its saturated, length-normalized
+//            frequency tf (k1 + 1) / (tf + k1 (1 - b + b len / averageLength))
+//   Jaccard  overlap |D & Q| / |D | Q| of the document and query term sets, the
+//            earlier stand-in for BIM, kept for comparison
+struct RankingModel {
+    enum Kind { Bim, Bm25, Jaccard } kind = Bm25;
+    double k1 = 1.2;   // how quickly repeated occurrences stop adding to a term's score
+    double b = 0.75;   // how strongly the score is normalized by document length
+
+    string name() const {
+        if (kind == Bim) return "bim";
+        if (kind == Jaccard) return "jaccard";
+        ostringstream out;
+        out << "bm25(" << k1 << "," << b << ")";
+        return out.str();
+    }
+};
+
+// Function to return the top k documents for the query under the given model. Each
+// query term gets a WAND cursor whose upper bound is the most it can add to any
+// document: its RSJ weight for BIM, the BM25 term score at its largest tf in the
+// shortest document, and 1 / |Q| for Jaccard since m matching terms score at most
+// m / |Q|. When a cache is given, queries with the same model, words and k share one entry.
+vector<pair<string, double>> retrieveRanked(const InvertedIndex& index, const vector<pair<string, MappedFile>>& documents,
+                                            const string& query, size_t k, const RankingModel& model,
+                                            ResultCache<double>* cache = nullptr) {
     // Tokenize the query
     vector<string> queryTokens = tokenize(query);
     set<string> querySet(queryTokens.begin(), queryTokens.end());
+    double querySize = static_cast<double>(querySet.size());
 
-    for (const auto& [fileName, content] : documents) {
-        // Tokenize the document content
-        vector<string> docTokens = tokenize(content);
-        set<string> docSet(docTokens.begin(), docTokens.end());
-
-        // Calculate Jaccard similarity
-        double score = calculateJaccard(docSet, querySet);
-        scores.emplace_back(fileName, score);
+    vector<pair<string, double>> scores;
+    string cacheKey = model.name() + ' ' + to_string(k);
+    for (const string& word : querySet) cacheKey += ' ' + word;
+    if (cache && cache->lookup(cacheKey, scores)) return scores;
+
+    auto lengthNorm = [&](int length) { return model.k1 * (1.0 - model.b + model.b * length / index.averageLength); };
+    vector<TermCursor> cursors;
+    for (uint32_t id : lookupTerms(index.vocabulary, queryTokens)) {
+        double idf = index.idf[id], upperBound = idf;
+        if (model.kind == RankingModel::Bm25) {
+            double maxTf = index.maxTermFrequency[id];
+            upperBound = idf * maxTf * (model.k1 + 1.0) / (maxTf + lengthNorm(index.shortestLength));
+        } else if (model.kind == RankingModel::Jaccard) {
+            upperBound = 1.0 / querySize;
+        }
+        cursors.push_back({&index.postings[id], 0, upperBound, idf});
     }
 
-    // Sort based on scores in descending order
-    sort(scores.begin(), scores.end(), [](const auto& a, const auto& b) { return a.second > b.second; });
-
+    DocumentScorer scorer;
+    if (model.kind == RankingModel::Bim) {
+        scorer = [](int, const vector<const TermCursor*>& matched) {
+            double score = 0.0;
+            for (const TermCursor* cursor : matched) score += cursor->weight;
+            return score;
+        };
+    } else if (model.kind == RankingModel::Bm25) {
+        scorer = [&](int doc, const vector<const TermCursor*>& matched) {
+            double norm = lengthNorm(index.documentLengths[doc]), score = 0.0;
+            for (const TermCursor* cursor : matched) {
+                double tf = cursor->posting().tf;
+                score += cursor->weight * tf * (model.k1 + 1.0) / (tf + norm);
+            }
+            return score;
+        };
+    } else {
+        scorer = [&](int doc, const vector<const TermCursor*>& matched) {
+            double intersection = static_cast<double>(matched.size());
+            return intersection / (index.distinctTerms[doc] + querySize - intersection);
+        };
+    }
+    for (const auto& [doc, score] : wandTopK(move(cursors), k, scorer, [](int) { return false; })) {
+        scores.emplace_back(documents[doc].first, score);
+    }
+    if (cache) cache->insert(cacheKey, scores);
     return scores;
 }
 
-// Non-Overlapped List Model
-vector<string> retrieveNonOverlapping(const vector<pair<string, string>>& documents, const vector<string>& terms) {
+// Non-Overlapped List Model, reference version: scans the text of every document
+// for every term. Kept to check and time the trigram index against.
+vector<string> retrieveNonOverlappingReference(const vector<pair<string, MappedFile>>& documents, const vector<string>& terms) {
     vector<string> fileNames;
     unordered_set<string> fileNameSet;
 
     for (const auto& term : terms) {
         for (const auto& [fileName, content] : documents) {
-            if (content.find(term) != string::npos) {
+            if (content.view().find(term) != string_view::npos) {
                 fileNameSet.insert(fileName);
             }
         }
@@ -79,88 +243,374 @@ vector<string> retrieveNonOverlapping(const vector<pair<string, string>>& docume
     return fileNames;
 }
 
-// Function to build a graph from the document
-unordered_map<string, vector<string>> buildGraph(const string& content) {
-    unordered_map<string, vector<string>> graph;
-    vector<string> tokens = tokenize(content);
+// Trigram index over the raw document text. A document can only contain a string
+// if it contains every 3-byte window of it, so the documents holding all of a
+// term's trigrams are the only ones whose text needs to be checked.
+struct TrigramIndex {
+    unordered_map<uint32_t, vector<int>> postings;  // trigram -> documents containing it, ascending
+    int documentCount = 0;
+};
+
+uint32_t trigramAt(string_view text, size_t i) {
+    return static_cast<uint32_t>(static_cast<unsigned char>(text[i])) << 16 |
+           static_cast<uint32_t>(static_cast<unsigned char>(text[i + 1])) << 8 |
+           static_cast<unsigned char>(text[i + 2]);
+}
+
+// Function to build the trigram index from the documents
+TrigramIndex buildTrigramIndex(const vector<pair<string, MappedFile>>& documents) {
+    TrigramIndex index;
+    index.documentCount = static_cast<int>(documents.size());
+    vector<char> seen(1 << 24, 0);  // one flag per possible trigram, cleared after each document
+    vector<uint32_t> trigrams;
+    for (size_t doc = 0; doc < documents.size(); ++doc) {
+        string_view content = documents[doc].second.view();
+        trigrams.clear();
+        for (size_t i = 0; i + 2 < content.size(); ++i) {
+            uint32_t trigram = trigramAt(content, i);
+            if (!seen[trigram]) {
+                seen[trigram] = 1;
+                trigrams.push_back(trigram);
+            }
+        }
+        for (uint32_t trigram : trigrams) {
+            seen[trigram] = 0;
+            index.postings[trigram].push_back(static_cast<int>(doc));
+        }
+    }
+    return index;
+}
 
-    for (size_t i = 0; i < tokens.size(); ++i) {
-        for (size_t j = i + 1; j < tokens.size() && j <= i + 2; ++j) {  // Proximity of 2 words
-            graph[tokens[i]].push_back(tokens[j]);
-            graph[tokens[j]].push_back(tokens[i]);
+// Function to match a word against a pattern in which '*' stands for any run of characters
+bool wildcardMatch(string_view word, string_view pattern) {
+    size_t w = 0, p = 0, star = string_view::npos, resume = 0;
+    while (w < word.size()) {
+        if (p < pattern.size() && pattern[p] == '*') {
+            star = p++;
+            resume = w;
+        } else if (p < pattern.size() && pattern[p] == word[w]) {
+            ++p;
+            ++w;
+        } else if (star != string_view::npos) {
+            p = star + 1;
+            w = ++resume;
+        } else {
+            return false;
         }
     }
-    return graph;
+    while (p < pattern.size() && pattern[p] == '*') ++p;
+    return p == pattern.size();
+}
+
+// Function to check one document against a term. A plain term is a substring, as in
+// the reference model; a term with '*' must match a whole alphanumeric word. Such a
+// word contains the term's longest literal piece, so only the words around the
+// occurrences of that piece are tried.
+bool documentMatches(string_view content, const string& term) {
+    if (term.find('*') == string::npos) return content.find(term) != string_view::npos;
+
+    string longest;
+    stringstream pieces(term);
+    for (string piece; getline(pieces, piece, '*');) {
+        if (piece.size() > longest.size()) longest = piece;
+    }
+    auto isWordChar = [&](size_t i) { return isalnum(static_cast<unsigned char>(content[i])) != 0; };
+
+    size_t end = 0;  // words before this offset have been tried already
+    for (size_t found = content.find(longest); found != string_view::npos; found = content.find(longest, max(found + 1, end))) {
+        size_t start = found;
+        while (start > 0 && isWordChar(start - 1)) --start;
+        end = found;
+        while (end < content.size() && isWordChar(end)) ++end;
+        if (end > start && wildcardMatch(content.substr(start, end - start), term)) return true;
+    }
+    return false;
 }
 
-// Function to explore the graph and retrieve documents connected to query nodes
-bool isConnectedToQuery(const unordered_map<string, vector<string>>& graph, const vector<string>& queryTokens) {
-    unordered_set<string> visited;
-    queue<string> q;
+// Function to find the documents that contain every trigram of the term's literal
+// pieces. Pieces shorter than three bytes say nothing, so a term without any
+// trigram leaves every document a candidate.
+vector<int> trigramCandidates(const TrigramIndex& index, const string& term) {
+    vector<const vector<int>*> lists;
+    size_t start = 0;
+    while (start <= term.size()) {
+        size_t end = min(term.find('*', start), term.size());
+        string piece = term.substr(start, end - start);
+        for (size_t i = 0; i + 2 < piece.size(); ++i) {
+            auto it = index.postings.find(trigramAt(piece, i));
+            if (it == index.postings.end()) return {};
+            lists.push_back(&it->second);
+        }
+        start = end + 1;
+    }
+
+    vector<int> candidates;
+    if (lists.empty()) {
+        for (int doc = 0; doc < index.documentCount; ++doc) candidates.push_back(doc);
+        return candidates;
+    }
+    sort(lists.begin(), lists.end(), [](const vector<int>* a, const vector<int>* b) { return a->size() < b->size(); });
+    candidates = *lists[0];
+    vector<int> kept;
+    for (size_t i = 1; i < lists.size() && !candidates.empty(); ++i) {
+        kept.clear();
+        set_intersection(candidates.begin(), candidates.end(), lists[i]->begin(), lists[i]->end(), back_inserter(kept));
+        candidates.swap(kept);
+    }
+    return candidates;
+}
 
-    // Add query tokens to the queue
-    for (const string& token : queryTokens) {
-        if (graph.find(token) != graph.end()) {
-            q.push(token);
-            visited.insert(token);
+// Non-Overlapped List Model: the documents matching any of the terms, in document
+// order. Terms may be substrings or wildcard patterns such as foo*, *bar and a*b.
+vector<string> retrieveNonOverlapping(const TrigramIndex& trigrams, const vector<pair<string, MappedFile>>& documents,
+                                      const vector<string>& terms) {
+    vector<char> matched(documents.size(), 0);
+    for (const string& term : terms) {
+        for (int doc : trigramCandidates(trigrams, term)) {
+            if (!matched[doc] && documentMatches(documents[doc].second.view(), term)) matched[doc] = 1;
         }
     }
 
-    while (!q.empty()) {
-        string current = q.front();
-        q.pop();
+    vector<string> fileNames;
+    for (size_t doc = 0; doc < documents.size(); ++doc) {
+        if (matched[doc]) fileNames.push_back(documents[doc].first);
+    }
+    return fileNames;
+}
 
-        for (const string& neighbor : graph.at(current)) {
-            if (visited.find(neighbor) == visited.end()) {  // Not visited
-                visited.insert(neighbor);
-                q.push(neighbor);
-            }
+// Function to call visit for every document that contains all the given terms
+// (repeats allowed). The shortest postings list drives the walk and the others are
+// only searched forward from where they last matched; matches[i] is the posting of terms[i].
+void intersectPostings(const InvertedIndex& index, const vector<uint32_t>& terms,
+                       const function<void(int doc, const vector<const Posting*>& matches)>& visit) {
+    if (terms.empty()) return;
+    size_t shortest = 0;
+    for (size_t i = 1; i < terms.size(); ++i) {
+        if (index.postings[terms[i]].size() < index.postings[terms[shortest]].size()) shortest = i;
+    }
+
+    vector<size_t> cursors(terms.size(), 0);
+    vector<const Posting*> matches(terms.size());
+    for (const Posting& candidate : index.postings[terms[shortest]]) {
+        bool inAll = true;
+        for (size_t i = 0; i < terms.size() && inAll; ++i) {
+            const vector<Posting>& list = index.postings[terms[i]];
+            cursors[i] = lower_bound(list.begin() + cursors[i], list.end(), candidate.doc,
+                                     [](const Posting& p, int doc) { return p.doc < doc; }) - list.begin();
+            if (cursors[i] == list.size()) return;
+            inAll = list[cursors[i]].doc == candidate.doc;
+            matches[i] = &list[cursors[i]];
         }
+        if (inAll) visit(candidate.doc, matches);
     }
+}
 
-    // If any query token connects to other nodes in the graph, return true
-    return !visited.empty();
+// Function to count the occurrences of a phrase: positions p of its first word for
+// which word i of the phrase occurs at p + i. Candidates are narrowed one word at a time.
+int countPhrase(const vector<PositionRange>& words) {
+    vector<int> starts(words[0].begin(), words[0].end());
+    for (size_t i = 1; i < words.size() && !starts.empty(); ++i) {
+        size_t kept = 0;
+        const int* next = words[i].begin();
+        for (int start : starts) {
+            while (next != words[i].end() && *next < start + static_cast<int>(i)) ++next;
+            if (next != words[i].end() && *next == start + static_cast<int>(i)) starts[kept++] = start;
+        }
+        starts.resize(kept);
+    }
+    return static_cast<int>(starts.size());
 }
 
-// Function to retrieve documents using the Proximal Nodes Model
-vector<string> retrieveProximalNodes(const vector<pair<string, string>>& documents, const vector<string>& queryTokens) {
-    vector<string> relevantDocuments;
+// Function to find the smallest distance between the first and last word of a window
+// that contains every term, merging the position lists in order
+int shortestSpan(const vector<PositionRange>& terms) {
+    vector<const int*> heads;
+    for (const PositionRange& range : terms) heads.push_back(range.begin());
+
+    int best = numeric_limits<int>::max();
+    while (true) {
+        size_t lowest = 0;
+        int highest = *heads[0];
+        for (size_t i = 1; i < heads.size(); ++i) {
+            if (*heads[i] < *heads[lowest]) lowest = i;
+            highest = max(highest, *heads[i]);
+        }
+        best = min(best, highest - *heads[lowest]);
+        if (++heads[lowest] == terms[lowest].end()) return best;
+    }
+}
 
-    for (const auto& [fileName, content] : documents) {
-        auto graph = buildGraph(content);
+// Proximal Nodes Model, answered from the positional index.
+//   "exact phrase"    documents containing the phrase, scored by its number of occurrences
+//   words /N          documents with all the words inside a window of at most N words
+//   words             documents with all the words, scored higher the closer they occur
+vector<pair<string, double>> retrieveProximalNodes(const InvertedIndex& index, const vector<pair<string, MappedFile>>& documents,
+                                                   const string& query) {
+    vector<pair<string, double>> results;
+    size_t open = query.find('"');
+    bool phrase = open != string::npos;
+    string text = query;
+    int maxDistance = numeric_limits<int>::max();
+    if (phrase) {
+        size_t close = query.find('"', open + 1);
+        text = query.substr(open + 1, close == string::npos ? string::npos : close - open - 1);
+    } else {
+        size_t slash = query.rfind('/');
+        if (slash != string::npos && query.find_first_of("0123456789", slash) != string::npos &&
+            all_of(query.begin() + slash + 1, query.end(), [](unsigned char ch) { return isdigit(ch) || isspace(ch); })) {
+            // A window wider than an int can hold is no limit at all
+            long long window = strtoll(query.c_str() + slash + 1, nullptr, 10);
+            maxDistance = static_cast<int>(min<long long>(window, numeric_limits<int>::max()));
+            text = query.substr(0, slash);
+        }
+    }
 
-        if (isConnectedToQuery(graph, queryTokens)) {
-            relevantDocuments.push_back(fileName);
+    // A phrase keeps its words in order, repeats included; a proximity query needs each word once
+    vector<string> words = tokenize(text);
+    vector<uint32_t> terms;
+    if (phrase) {
+        for (const string& word : words) {
+            uint32_t id = index.vocabulary.find(word);
+            if (id == Vocabulary::NOT_FOUND) return results;
+            terms.push_back(id);
         }
+    } else {
+        terms = lookupTerms(index.vocabulary, words);
+        set<string> distinctWords(words.begin(), words.end());
+        if (terms.size() < distinctWords.size()) return results;
     }
 
-    return relevantDocuments;
+    vector<pair<int, double>> scores;
+    vector<PositionRange> lists(terms.size());
+    intersectPostings(index, terms, [&](int doc, const vector<const Posting*>& matches) {
+        for (size_t i = 0; i < terms.size(); ++i) lists[i] = positionsOf(index, terms[i], *matches[i]);
+        if (phrase) {
+            int occurrences = countPhrase(lists);
+            if (occurrences > 0) scores.emplace_back(doc, occurrences);
+        } else {
+            int span = shortestSpan(lists);
+            if (span <= maxDistance) scores.emplace_back(doc, 1.0 / (1 + span - (static_cast<int>(terms.size()) - 1)));
+        }
+    });
+
+    stable_sort(scores.begin(), scores.end(), [](const pair<int, double>& a, const pair<int, double>& b) {
+        return a.second > b.second;
+    });
+    for (const auto& [doc, score] : scores) results.emplace_back(documents[doc].first, score);
+    return results;
 }
 
-// Function to read all text files in the given folder
-vector<pair<string, string>> readDocumentsFromFolder(const string& folderPath) {
-    vector<pair<string, string>> documents;
+// Function to map all text files in the given folder; their text is read on demand
+vector<pair<string, MappedFile>> readDocumentsFromFolder(const string& folderPath) {
+    vector<pair<string, MappedFile>> documents;
 
     for (const auto& entry : fs::directory_iterator(folderPath)) {
         if (entry.is_regular_file() && entry.path().extension() == ".txt") {
-            ifstream file(entry.path());
-            if (file) {
-                string content((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
-                documents.emplace_back(entry.path().filename().string(), content);
-            }
+            MappedFile file(entry.path().string());
+            if (file.isOpen()) documents.emplace_back(entry.path().filename().string(), move(file));
         }
     }
     return documents;
 }
 
-int main() {
+// Function to time the reference scan against the trigram index for each substring
+// term and check that both find the same documents
+void benchmarkSubstring(const vector<pair<string, MappedFile>>& documents, const vector<string>& terms) {
+    size_t bytes = 0;
+    for (const auto& document : documents) bytes += document.second.size();
+
+    auto start = chrono::steady_clock::now();
+    TrigramIndex trigrams = buildTrigramIndex(documents);
+    double buildSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << documents.size() << " documents, " << bytes / 1e6 << " MB, trigram index built in " << buildSeconds << " s\n";
+
+    for (const string& term : terms) {
+        // Wildcard terms have no reference model, so their baseline checks every document
+        start = chrono::steady_clock::now();
+        vector<string> scanned;
+        if (term.find('*') == string::npos) {
+            scanned = retrieveNonOverlappingReference(documents, {term});
+        } else {
+            for (const auto& [fileName, content] : documents) {
+                if (documentMatches(content.view(), term)) scanned.push_back(fileName);
+            }
+        }
+        double scanSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        start = chrono::steady_clock::now();
+        vector<string> indexed = retrieveNonOverlapping(trigrams, documents, {term});
+        double indexSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        sort(scanned.begin(), scanned.end());
+        sort(indexed.begin(), indexed.end());
+        cout << term << ": " << indexed.size() << " documents" << (scanned == indexed ? " (same as scan)" : " (DIFFERENT from scan)")
+             << ", scan " << scanSeconds * 1e3 << " ms, trigram " << indexSeconds * 1e3 << " ms, speedup "
+             << scanSeconds / indexSeconds << "x\n";
+    }
+}
+
+// Function to time reading and indexing the folder, then every model on each line
+// of the query file: BIM and BM25 top 10, proximity ranking, and the Non-Overlapped
+// List model with the line's words as terms
+void benchmarkQueries(const string& folderPath, const string& queryFile, const RankingModel& bm25) {
+    auto start = chrono::steady_clock::now();
+    vector<pair<string, MappedFile>> documents = readDocumentsFromFolder(folderPath);
+    InvertedIndex index = buildIndex(documents);
+    TrigramIndex trigrams = buildTrigramIndex(documents);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    size_t bytes = 0;
+    for (const auto& document : documents) bytes += document.second.size();
+    reportIndexing(documents.size(), bytes, seconds);
+
+    vector<string> queries = readBenchQueries(queryFile);
+    size_t results = 0;
+    auto timeModel = [&](const string& model, const function<size_t(const string&)>& run) {
+        timeQueries(model, queries, [&](const string& query) { results += run(query); });
+    };
+    RankingModel bim{RankingModel::Bim};
+    timeModel("bim", [&](const string& query) { return retrieveRanked(index, documents, query, 10, bim).size(); });
+    timeModel("bm25", [&](const string& query) { return retrieveRanked(index, documents, query, 10, bm25).size(); });
+    timeModel("proximal", [&](const string& query) { return retrieveProximalNodes(index, documents, query).size(); });
+    timeModel("non_overlapping", [&](const string& query) {
+        return retrieveNonOverlapping(trigrams, documents, tokenize(query)).size();
+    });
+    cout << results << " results in total\n";
+}
+
+int main(int argc, char* argv[]) {
+    // --k1 <x> and --b <x> tune BM25 (defaults 1.2 and 0.75); the other flags are modes
+    RankingModel bm25{RankingModel::Bm25};
+    vector<string> args;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--k1" && i + 1 < argc) bm25.k1 = max(0.0, atof(argv[++i]));
+        else if (arg == "--b" && i + 1 < argc) bm25.b = min(1.0, max(0.0, atof(argv[++i])));
+        else args.push_back(arg);
+    }
+
+    if (args.size() == 2 && args[0] == "--bench-tokenizer") {
+        benchmarkTokenizer<TokenRule::Alphanumeric>(args[1]);
+        return 0;
+    }
+    if (args.size() == 2 && args[0] == "--bench-queries") {
+        benchmarkQueries("./", args[1], bm25);
+        return 0;
+    }
+
     string folderPath = "./";  // Current folder
-    vector<pair<string, string>> documents = readDocumentsFromFolder(folderPath);
+    vector<pair<string, MappedFile>> documents = readDocumentsFromFolder(folderPath);
 
     if (documents.empty()) {
         cout << "No text documents found in the folder.\n";
         return 1;
     }
+    if (args.size() >= 2 && args[0] == "--bench-substring") {
+        benchmarkSubstring(documents, vector<string>(args.begin() + 1, args.end()));
+        return 0;
+    }
+    InvertedIndex index = buildIndex(documents);
+    TrigramIndex trigrams = buildTrigramIndex(documents);
+    ResultCache<double> rankingCache(16 << 20);
 
     // User selects the model
     int modelChoice;
@@ -169,21 +619,24 @@ int main() {
         cout << "1. Binary Independence Model (BIM)\n";
         cout << "2. Non-Overlapped List Model\n";
         cout << "3. Proximal Nodes Model\n";
-        cout << "4. Exit\n";
-        cout << "Enter your choice (1-4): ";
+        cout << "4. BM25 Model\n";
+        cout << "5. Exit\n";
+        cout << "Enter your choice (1-5): ";
         cin >> modelChoice;
         cin.ignore();  // To discard the newline character after the integer input
-        if (modelChoice == 1) {
-            // User input for BIM model
+        if (modelChoice == 1 || modelChoice == 4) {
+            // User input for BIM or BM25 model
+            RankingModel model = modelChoice == 1 ? RankingModel{RankingModel::Bim} : bm25;
+            string label = modelChoice == 1 ? "BIM" : "BM25";
             string query;
-            cout << "Enter your query for BIM model: ";
+            cout << "Enter your query for " << label << " model: ";
             getline(cin, query);
 
-            // BIM Results
-            cout << "BIM Results:\n";
-            vector<pair<string, double>> bimResults = retrieveDocumentsBIM(documents, query);
+            // BIM / BM25 Results
+            cout << label << " Results:\n";
+            vector<pair<string, double>> rankedResults = retrieveRanked(index, documents, query, 10, model, &rankingCache);
             bool found = false;  // Flag to track if any relevant documents are found
-            for (const auto& [fileName, score] : bimResults) {
+            for (const auto& [fileName, score] : rankedResults) {
                 if (score > 0.0) {  // Only show documents with a positive score
                     cout << "File Name: " << fileName << ", Score: " << score << "\n";
                     found = true;
@@ -202,14 +655,14 @@ int main() {
             cin.ignore();  // To discard the newline character after the integer input
 
             vector<string> terms(numTerms);
-            cout << "Enter the query terms:\n";
+            cout << "Enter the query terms (substrings, or patterns like foo*, *bar, a*b):\n";
             for (int i = 0; i < numTerms; ++i) {
                 getline(cin, terms[i]);
             }
 
             // Non-Overlapped List Model Results
             cout << "Non-Overlapped List Model Results:\n";
-            vector<string> nonOverlappedResults = retrieveNonOverlapping(documents, terms);
+            vector<string> nonOverlappedResults = retrieveNonOverlapping(trigrams, documents, terms);
             if (nonOverlappedResults.empty()) {
                 cout << "No relevant documents found.\n";
             } else {
@@ -221,25 +674,23 @@ int main() {
         else if (modelChoice == 3) {
             // User input for Proximal Nodes Model
             string query;
-            cout << "Enter your query: ";
+            cout << "Enter your query (\"exact phrase\", or words with an optional /N distance): ";
             getline(cin, query);
 
-            // Tokenize query
-            vector<string> queryTokens = tokenize(query);
-
             // Retrieve documents using Proximal Nodes Model
             cout << "Proximal Nodes Model Results:\n";
-            vector<string> results = retrieveProximalNodes(documents, queryTokens);
+            vector<pair<string, double>> results = retrieveProximalNodes(index, documents, query);
             if(results.empty()){
                 cout << "No relevant documents found.\n";
             }
             else{
-                for (const string& fileName : results) {
-                    cout << "File Name: " << fileName << "\n";
+                for (const auto& [fileName, score] : results) {
+                    cout << "File Name: " << fileName << ", Score: " << score << "\n";
                 }
             }
         } 
-        else if (modelChoice == 4) {
+        else if (modelChoice == 5) {
+            cout << "Ranking result cache: " << rankingCache.hitCount() << " hits, " << rankingCache.missCount() << " misses\n";
             break;
         }
         else {
@@ -8,22 +8,213 @@
 #include <sstream>
 #include <algorithm>
 #include <cmath>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <cstdint>
+#include <string_view>
+#include <chrono>
+#include <shared_mutex>
+#include <tuple>
+#include <map>
+#include <set>
+#include <list>
+#include <queue>
+#include <condition_variable>
+#include <memory_resource>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+#ifndef _WIN32
+#include <cerrno>
+#include <cstring>
+#include <csignal>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "../common/token_stream.h"
+#include "../common/scratch_arena.h"
+#include "../common/parallel_for.h"
+#include "../common/result_cache.h"
+#include "../common/vocabulary.h"
+#include "../common/wand.h"
+#include "../common/name_index.h"
+#include "../common/bench_report.h"
 
 namespace fs = std::filesystem;
 using namespace std;
 
-vector<string> tokenize(const string &text) {
+// Lowercase whitespace-separated tokens
+using TokenStream = BasicTokenStream<TokenRule::Whitespace>;
+using ChunkedTokens = BasicChunkedTokens<TokenRule::Whitespace>;
+
+// Instrumentation, compiled in with -DIR_METRICS and compiled out otherwise.
+// METRIC_TIMER(stage) times the rest of its scope into a per-stage log2
+// histogram and, while a QueryTrace is alive on the same thread, into that
+// trace's breakdown; METRIC_COUNT(counter, n) adds to a relaxed atomic counter.
+// metricsText() renders everything in the Prometheus text format. Without
+// IR_METRICS the macros expand to nothing and QueryTrace is an empty stub.
+#ifdef IR_METRICS
+enum Stage {
+    STAGE_INDEX_READ, STAGE_INDEX_ANALYZE, STAGE_INDEX_MERGE,
+    STAGE_TOKENIZE, STAGE_LOCK_WAIT, STAGE_CACHE, STAGE_SCORE, STAGE_SORT,
+    STAGE_COUNT
+};
+enum Counter {
+    COUNTER_KEYWORD_QUERIES, COUNTER_SIMILAR_QUERIES, COUNTER_BATCH_QUERIES,
+    COUNTER_DOCUMENTS_INDEXED, COUNTER_BYTES_INDEXED, COUNTER_DOCUMENTS_SCORED,
+    COUNTER_COUNT
+};
+const char *const stageNames[STAGE_COUNT] = {"index_read", "index_analyze", "index_merge", "tokenize",
+                                             "lock_wait",  "cache",         "score",       "sort"};
+const char *const counterNames[COUNTER_COUNT] = {"keyword_queries",   "similar_queries", "batch_queries",
+                                                 "documents_indexed", "bytes_indexed",   "documents_scored"};
+
+class Metrics {
+public:
+    static constexpr int BUCKETS = 40;                      // bucket b holds durations below 2^(b+1) ns
+
+    static Metrics &instance() {
+        static Metrics metrics;
+        return metrics;
+    }
+
+    void record(Stage stage, uint64_t nanoseconds) {
+        int bucket = min(BUCKETS - 1, nanoseconds == 0 ? 0 : 63 - __builtin_clzll(nanoseconds));
+        histograms[stage][bucket].fetch_add(1, memory_order_relaxed);
+        totals[stage].fetch_add(nanoseconds, memory_order_relaxed);
+    }
+
+    void add(Counter counter, uint64_t amount) {
+        counters[counter].fetch_add(amount, memory_order_relaxed);
+    }
+
+    string text() const {
+        ostringstream out;
+        out << "# TYPE ir_stage_seconds histogram\n";
+        for (int stage = 0; stage < STAGE_COUNT; stage++) {
+            uint64_t cumulative = 0;
+            for (int bucket = 0; bucket < BUCKETS; bucket++) {
+                cumulative += histograms[stage][bucket].load(memory_order_relaxed);
+                out << "ir_stage_seconds_bucket{stage=\"" << stageNames[stage] << "\",le=\""
+                    << static_cast<double>(2ull << bucket) / 1e9 << "\"} " << cumulative << "\n";
+            }
+            out << "ir_stage_seconds_bucket{stage=\"" << stageNames[stage] << "\",le=\"+Inf\"} " << cumulative << "\n";
+            out << "ir_stage_seconds_sum{stage=\"" << stageNames[stage] << "\"} " << totals[stage].load(memory_order_relaxed) / 1e9
+                << "\n";
+            out << "ir_stage_seconds_count{stage=\"" << stageNames[stage] << "\"} " << cumulative << "\n";
+        }
+        for (int counter = 0; counter < COUNTER_COUNT; counter++) {
+            out << "# TYPE ir_" << counterNames[counter] << "_total counter\n";
+            out << "ir_" << counterNames[counter] << "_total " << counters[counter].load(memory_order_relaxed) << "\n";
+        }
+        return out.str();
+    }
+
+private:
+    atomic<uint64_t> histograms[STAGE_COUNT][BUCKETS] = {};
+    atomic<uint64_t> totals[STAGE_COUNT] = {};
+    atomic<uint64_t> counters[COUNTER_COUNT] = {};
+};
+
+// Per-query breakdown: stage timers on this thread add to the innermost live trace
+class QueryTrace {
+public:
+    QueryTrace() : outer(active) {
+        active = this;
+    }
+
+    ~QueryTrace() {
+        active = outer;
+    }
+
+    static void add(Stage stage, uint64_t nanoseconds) {
+        if (active != nullptr) {
+            active->nanoseconds[stage] += nanoseconds;
+        }
+    }
+
+    string format() const {
+        ostringstream out;
+        for (int stage = 0; stage < STAGE_COUNT; stage++) {
+            if (nanoseconds[stage] > 0) {
+                out << (out.tellp() > 0 ? ", " : "") << stageNames[stage] << " " << nanoseconds[stage] / 1e3 << " us";
+            }
+        }
+        return out.str();
+    }
+
+private:
+    static thread_local QueryTrace *active;
+    QueryTrace *outer;
+    uint64_t nanoseconds[STAGE_COUNT] = {};
+};
+thread_local QueryTrace *QueryTrace::active = nullptr;
+
+class StageTimer {
+public:
+    explicit StageTimer(Stage stage) : stage(stage), start(chrono::steady_clock::now()) {}
+
+    ~StageTimer() {
+        uint64_t elapsed = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+        Metrics::instance().record(stage, elapsed);
+        QueryTrace::add(stage, elapsed);
+    }
+
+private:
+    Stage stage;
+    chrono::steady_clock::time_point start;
+};
+
+string metricsText() {
+    return Metrics::instance().text();
+}
+
+#define METRIC_CONCAT(a, b) a##b
+#define METRIC_NAME(line) METRIC_CONCAT(metricTimer, line)
+#define METRIC_TIMER(stage) StageTimer METRIC_NAME(__LINE__)(stage)
+#define METRIC_COUNT(counter, n) Metrics::instance().add(counter, n)
+#else
+class QueryTrace {
+public:
+    string format() const {
+        return "per-query breakdown needs a build with -DIR_METRICS";
+    }
+};
+
+string metricsText() {
+    return "";
+}
+
+#define METRIC_TIMER(stage)
+#define METRIC_COUNT(counter, n)
+#endif
+
+vector<string> tokenize(string text) {
     vector<string> tokens;
-    stringstream ss(text);
-    string word;
-    while (ss >> word) {
-        transform(word.begin(), word.end(), word.begin(), ::tolower);
-        tokens.push_back(word);
+    TokenStream stream(text.data(), text.size());
+    string_view token;
+    while (stream.next(token)) {
+        tokens.emplace_back(token);
     }
     return tokens;
 }
 
-float cosineSimilarity(const unordered_map<string, float> &vec1, const unordered_map<string, float> &vec2) {
+// Reference map-based version, kept to check and time the sparse kernel against
+float cosineSimilarity(const unordered_map<uint32_t, float> &vec1, const unordered_map<uint32_t, float> &vec2) {
     float dotProduct = 0.0f, magnitude1 = 0.0f, magnitude2 = 0.0f;
     for (const auto &[term, weight] : vec1) {
         if (vec2.find(term) != vec2.end()) {
@@ -37,87 +228,756 @@ float cosineSimilarity(const unordered_map<string, float> &vec1, const unordered
     return (magnitude1 > 0 && magnitude2 > 0) ? (dotProduct / (sqrt(magnitude1) * sqrt(magnitude2))) : 0.0f;
 }
 
+// Document vector stored as parallel arrays sorted by term id, with its
+// magnitude computed once when the document is indexed
+struct SparseVector {
+    vector<uint32_t> terms;
+    vector<float> weights;
+    float norm = 0.0f;
+};
+
+// Sum of weight products over the terms both vectors contain, found by merging
+// the two sorted term lists. With SSE2 the merge advances four ids at a time on
+// each side, comparing the blocks all-against-all in four rotations; term ids
+// are unique within a vector, so every shared term is matched exactly once.
+float sparseDot(const SparseVector &a, const SparseVector &b) {
+    const uint32_t *termsA = a.terms.data(), *termsB = b.terms.data();
+    const float *weightsA = a.weights.data(), *weightsB = b.weights.data();
+    size_t sizeA = a.terms.size(), sizeB = b.terms.size();
+    size_t i = 0, j = 0;
+    float dot = 0.0f;
+
+#if defined(__SSE2__)
+    __m128 sum = _mm_setzero_ps();
+    while (i + 4 <= sizeA && j + 4 <= sizeB) {
+        __m128i idsA = _mm_loadu_si128(reinterpret_cast<const __m128i *>(termsA + i));
+        __m128i idsB = _mm_loadu_si128(reinterpret_cast<const __m128i *>(termsB + j));
+        __m128 valuesA = _mm_loadu_ps(weightsA + i);
+        __m128 valuesB = _mm_loadu_ps(weightsB + j);
+        for (int rotation = 0; rotation < 4; rotation++) {
+            __m128 equal = _mm_castsi128_ps(_mm_cmpeq_epi32(idsA, idsB));
+            sum = _mm_add_ps(sum, _mm_and_ps(equal, _mm_mul_ps(valuesA, valuesB)));
+            idsB = _mm_shuffle_epi32(idsB, _MM_SHUFFLE(0, 3, 2, 1));
+            valuesB = _mm_shuffle_ps(valuesB, valuesB, _MM_SHUFFLE(0, 3, 2, 1));
+        }
+        uint32_t lastA = termsA[i + 3], lastB = termsB[j + 3];
+        if (lastA <= lastB) {
+            i += 4;
+        }
+        if (lastB <= lastA) {
+            j += 4;
+        }
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, sum);
+    dot = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#endif
+
+    while (i < sizeA && j < sizeB) {
+        if (termsA[i] < termsB[j]) {
+            i++;
+        } else if (termsB[j] < termsA[i]) {
+            j++;
+        } else {
+            dot += weightsA[i++] * weightsB[j++];
+        }
+    }
+    return dot;
+}
+
+float cosineSimilarity(const SparseVector &vec1, const SparseVector &vec2) {
+    return (vec1.norm > 0 && vec2.norm > 0) ? sparseDot(vec1, vec2) / (vec1.norm * vec2.norm) : 0.0f;
+}
+
+// One entry of a term's postings list; the weight is already divided by the
+// document's vector magnitude so cosine scoring is a plain weighted sum
+struct Posting {
+    uint32_t doc;
+    float weight;
+};
+
+// A query term during a top-k search; its weight is the query weight divided by
+// the query magnitude and its upper bound that times the largest weight in the list
+using TermCursor = BasicTermCursor<Posting, float>;
+
 class GeneralizedVectorModel {
 private:
+    // Everything one document contributes to the model, computed without
+    // touching shared state so documents can be analysed in parallel. The
+    // distinct terms are packed back to back into termText, so a document costs
+    // a fixed handful of allocations however many terms it has.
+    struct TermStats {
+        uint32_t offset, length;                            // slice of termText
+        int count;
+        float weight;
+    };
+
+    struct DocumentStats {
+        string name;
+        string termText;
+        vector<TermStats> terms;
+
+        string_view term(const TermStats &stats) const {
+            return string_view(termText).substr(stats.offset, stats.length);
+        }
+    };
+
     string folderPath;
-    unordered_map<string, unordered_map<string, float>> documentVectors; // Document vectors
-    unordered_map<string, int> termFrequency;                             // Global term frequency
-    unordered_set<string> documentNames;
+    unsigned threadCount;
+    Vocabulary vocabulary;
+    vector<SparseVector> documentVectors;                   // doc id -> weights sorted by term id
+    vector<int> termFrequency;                              // Global term frequency by term id
+    NameIndex documentNames;
+    vector<string> documentIds;                             // doc id -> document name
+    vector<vector<Posting>> postings;                       // term id -> postings in doc id order
+    vector<float> maxWeight;                                // term id -> largest weight in its postings
+    vector<vector<int>> documentCounts;                     // doc id -> term counts, aligned with its vector
+    vector<char> deleted;                                   // doc id -> tombstone of a removed or replaced version
+    size_t deletedCount = 0;
+    unordered_map<string, uint32_t> liveIds;                // document name -> id of its current version
 
-    void processDocument(const string &docName, const string &content) {
-        unordered_map<string, int> localFrequency;
-        vector<string> tokens = tokenize(content);
+    // Queries share modelLock. Updates hold updateLock throughout and modelLock
+    // exclusively only while they change the model. Compaction holds updateLock,
+    // builds the compacted model under a shared lock so queries keep running, and
+    // takes the exclusive lock just to swap it in.
+    mutable shared_mutex modelLock;
+    mutex updateLock;
+    uint64_t generation = 0;                                // bumped by every change to the document set
+    mutable ResultCache<float> keywordCache;
+    thread compactor;
+    atomic<bool> compacting{false};
 
-        for (const string &token : tokens) {
-            localFrequency[token]++;
-            termFrequency[token]++;
+    // Tokens are read from content a chunk at a time and counted in a table on
+    // the thread's scratch arena, which also holds the text of each distinct
+    // term; only those terms are copied out into the result
+    static DocumentStats analyzeDocument(const string &docName, string_view content) {
+        DocumentStats stats;
+        stats.name = docName;
+        ScratchArena arena;
+        pmr::unordered_map<string_view, int> counts(arena.get());
+        ChunkedTokens tokens(content);
+        string_view token;
+        while (tokens.next(token)) {
+            auto it = counts.find(token);
+            if (it == counts.end()) {
+                char *text = static_cast<char *>(arena.get()->allocate(max<size_t>(token.size(), 1), 1));
+                memcpy(text, token.data(), token.size());
+                it = counts.emplace(string_view(text, token.size()), 0).first;
+            }
+            it->second++;
         }
 
         float maxFrequency = 0;
-        for (const auto &[term, freq] : localFrequency) {
+        for (const auto &[term, freq] : counts) {
             maxFrequency = max(maxFrequency, static_cast<float>(freq));
         }
 
-        for (const auto &[term, freq] : localFrequency) {
-            documentVectors[docName][term] = 0.5 + 0.5 * (freq / maxFrequency); // TF normalization
+        size_t textSize = 0;
+        for (const auto &[term, freq] : counts) {
+            textSize += term.size();
+        }
+        stats.termText.reserve(textSize);
+        stats.terms.reserve(counts.size());
+        for (const auto &[term, freq] : counts) {
+            float weight = 0.5 + 0.5 * (freq / maxFrequency); // TF normalization
+            stats.terms.push_back({static_cast<uint32_t>(stats.termText.size()), static_cast<uint32_t>(term.size()), freq, weight});
+            stats.termText += term;
         }
-        documentNames.insert(docName);
+        return stats;
     }
-    string stripExtension(const string &fileName) const {
-        size_t lastDot = fileName.find_last_of('.');
-        return (lastDot == string::npos) ? fileName : fileName.substr(0, lastDot);
+
+    void addDocument(DocumentStats &&stats) {
+        float magnitude = 0.0f;
+        for (const TermStats &term : stats.terms) {
+            magnitude += term.weight * term.weight;
+        }
+        magnitude = sqrt(magnitude);
+
+        uint32_t docId = static_cast<uint32_t>(documentIds.size());
+        vector<tuple<uint32_t, float, int>> entries;
+        entries.reserve(stats.terms.size());
+        for (const TermStats &term : stats.terms) {
+            uint32_t termId = vocabulary.intern(stats.term(term));
+            if (termId == postings.size()) {
+                postings.emplace_back();
+                maxWeight.push_back(0.0f);
+                termFrequency.push_back(0);
+            }
+            float normalized = term.weight / magnitude;
+            postings[termId].push_back({docId, normalized});
+            maxWeight[termId] = max(maxWeight[termId], normalized);
+            termFrequency[termId] += term.count;
+            entries.emplace_back(termId, term.weight, term.count);
+        }
+
+        sort(entries.begin(), entries.end());
+        SparseVector &documentVector = documentVectors.emplace_back();
+        vector<int> &counts = documentCounts.emplace_back();
+        documentVector.terms.reserve(entries.size());
+        documentVector.weights.reserve(entries.size());
+        counts.reserve(entries.size());
+        for (const auto &[termId, weight, count] : entries) {
+            documentVector.terms.push_back(termId);
+            documentVector.weights.push_back(weight);
+            counts.push_back(count);
+        }
+        documentVector.norm = magnitude;
+        documentIds.push_back(stats.name);
+        documentNames.add(stats.name);
+        deleted.push_back(0);
+        liveIds[stats.name] = docId;
+        generation++;
+    }
+
+    // Tombstones a document version and takes its counts out of the global term
+    // frequencies. Its postings stay until the next compaction; maxWeight stays a
+    // valid upper bound because removing postings can only lower the maximum.
+    void retireDocument(uint32_t docId) {
+        const SparseVector &documentVector = documentVectors[docId];
+        for (size_t i = 0; i < documentVector.terms.size(); i++) {
+            termFrequency[documentVector.terms[i]] -= documentCounts[docId][i];
+        }
+        deleted[docId] = 1;
+        deletedCount++;
+        documentNames.remove(documentIds[docId]);
+        liveIds.erase(documentIds[docId]);
+        generation++;
+    }
+
+    // Normalised query term weights of the indexed query terms. Called with the
+    // model locked.
+    vector<pair<uint32_t, float>> queryWeights(const vector<string> &queryTokens) const {
+        ScratchArena arena;
+        pmr::unordered_map<string_view, int> queryFrequency(arena.get());
+
+        for (const string &token : queryTokens) {
+            queryFrequency[token]++;
+        }
+
+        float queryMagnitude = 0.0f;
+        for (const auto &[term, freq] : queryFrequency) {
+            float weight = 0.5 + 0.5 * freq; // Simple TF
+            queryMagnitude += weight * weight;
+        }
+        queryMagnitude = sqrt(queryMagnitude);
+
+        vector<pair<uint32_t, float>> weights;
+        for (const auto &[term, freq] : queryFrequency) {
+            uint32_t termId = vocabulary.find(term);
+            if (termId != Vocabulary::NOT_FOUND) {
+                weights.emplace_back(termId, (0.5 + 0.5 * freq) / queryMagnitude);
+            }
+        }
+        sort(weights.begin(), weights.end());
+        return weights;
+    }
+
+    // Called with the model locked; compaction pays off once a quarter of the
+    // document ids are tombstones
+    bool needsCompaction() const {
+        return deletedCount >= 32 && deletedCount * 4 >= documentIds.size();
+    }
+
+    void startCompaction() {
+        bool idle = false;
+        if (!compacting.compare_exchange_strong(idle, true)) {
+            return;
+        }
+        if (compactor.joinable()) {
+            compactor.join();
+        }
+        compactor = thread([this]() {
+            compact();
+            compacting = false;
+        });
+    }
+
+    // Drops tombstoned documents and renumbers the live ones densely, keeping
+    // their relative order so every postings list stays sorted
+    void compact() {
+        lock_guard<mutex> writer(updateLock);
+        vector<string> keptIds;
+        vector<SparseVector> keptVectors;
+        vector<vector<int>> keptCounts;
+        vector<vector<Posting>> keptPostings;
+        vector<float> keptMaxWeight;
+        {
+            shared_lock<shared_mutex> reader(modelLock);
+            vector<uint32_t> newIds(documentIds.size(), UINT32_MAX);
+            for (uint32_t docId = 0; docId < documentIds.size(); docId++) {
+                if (!deleted[docId]) {
+                    newIds[docId] = static_cast<uint32_t>(keptIds.size());
+                    keptIds.push_back(documentIds[docId]);
+                    keptVectors.push_back(documentVectors[docId]);
+                    keptCounts.push_back(documentCounts[docId]);
+                }
+            }
+            keptPostings.resize(postings.size());
+            keptMaxWeight.assign(postings.size(), 0.0f);
+            for (size_t termId = 0; termId < postings.size(); termId++) {
+                for (const Posting &posting : postings[termId]) {
+                    if (newIds[posting.doc] != UINT32_MAX) {
+                        keptPostings[termId].push_back({newIds[posting.doc], posting.weight});
+                        keptMaxWeight[termId] = max(keptMaxWeight[termId], posting.weight);
+                    }
+                }
+            }
+        }
+
+        unique_lock<shared_mutex> exclusive(modelLock);
+        documentIds.swap(keptIds);
+        documentVectors.swap(keptVectors);
+        documentCounts.swap(keptCounts);
+        postings.swap(keptPostings);
+        maxWeight.swap(keptMaxWeight);
+        deleted.assign(documentIds.size(), 0);
+        deletedCount = 0;
+        liveIds.clear();
+        for (uint32_t docId = 0; docId < documentIds.size(); docId++) {
+            liveIds[documentIds[docId]] = docId;
+        }
     }
 
 public:
-    explicit GeneralizedVectorModel(const string &path) : folderPath(path) {}
+    explicit GeneralizedVectorModel(const string &path, unsigned threads = 1, size_t cacheBytes = 16 << 20)
+        : folderPath(path), threadCount(max(1u, threads)), keywordCache(cacheBytes) {}
+
+    ~GeneralizedVectorModel() {
+        if (compactor.joinable()) {
+            compactor.join();
+        }
+    }
 
+    // Files are read and analysed by threadCount workers; their results are
+    // merged in directory order, giving the same model as a serial build.
     void indexDocuments() {
+        vector<fs::path> files;
         for (const auto &entry : fs::directory_iterator(folderPath)) {
             if (entry.is_regular_file()) {
-                string fileName = entry.path().filename().string();
-                ifstream file(entry.path());
-                if (file.is_open()) {
-                    string content((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
-                    processDocument(fileName, content);
+                files.push_back(entry.path());
+            }
+        }
+
+        vector<DocumentStats> results(files.size());
+        vector<char> loaded(files.size(), 0);
+        parallelFor(files.size(), threadCount, [&](size_t i) {
+            unique_ptr<MappedFile> file;
+            {
+                METRIC_TIMER(STAGE_INDEX_READ);
+                file = make_unique<MappedFile>(files[i].string());
+                if (!file->isOpen()) {
+                    return;
                 }
             }
+            METRIC_TIMER(STAGE_INDEX_ANALYZE);
+            METRIC_COUNT(COUNTER_DOCUMENTS_INDEXED, 1);
+            METRIC_COUNT(COUNTER_BYTES_INDEXED, file->view().size());
+            results[i] = analyzeDocument(files[i].filename().string(), file->view());
+            loaded[i] = 1;
+        });
+
+        lock_guard<mutex> writer(updateLock);
+        unique_lock<shared_mutex> exclusive(modelLock);
+        METRIC_TIMER(STAGE_INDEX_MERGE);
+        for (size_t i = 0; i < results.size(); i++) {
+            if (loaded[i]) {
+                addDocument(move(results[i]));
+            }
         }
     }
-    void searchByDocumentName(const string &docName) const {
-        string strippedDocName = stripExtension(docName);
-        for (const string &storedDocName : documentNames) {
-            if (stripExtension(storedDocName) == strippedDocName) {
-                cout << "Document '" << storedDocName << "' found." << endl;
+
+    // Adds a document, or replaces the indexed version of it. The old version is
+    // only tombstoned, so the cost depends on this document and not on the corpus.
+    void upsertDocument(const string &docName, string_view content) {
+        DocumentStats stats = analyzeDocument(docName, content);
+        bool compactNow;
+        {
+            lock_guard<mutex> writer(updateLock);
+            unique_lock<shared_mutex> exclusive(modelLock);
+            auto it = liveIds.find(docName);
+            if (it != liveIds.end()) {
+                retireDocument(it->second);
+            }
+            addDocument(move(stats));
+            compactNow = needsCompaction();
+        }
+        if (compactNow) {
+            startCompaction();
+        }
+    }
+
+    bool removeDocument(const string &docName) {
+        bool compactNow;
+        {
+            lock_guard<mutex> writer(updateLock);
+            unique_lock<shared_mutex> exclusive(modelLock);
+            auto it = liveIds.find(docName);
+            if (it == liveIds.end()) {
+                return false;
+            }
+            retireDocument(it->second);
+            compactNow = needsCompaction();
+        }
+        if (compactNow) {
+            startCompaction();
+        }
+        return true;
+    }
+
+    // Brings one file of the folder up to date: indexes it again if it exists and
+    // removes it from the model if it does not
+    void reindexFile(const string &fileName) {
+        fs::path path = fs::path(folderPath) / fileName;
+        MappedFile file(path.string());
+        if (file.isOpen()) {
+            upsertDocument(fileName, file.view());
+            cout << "Document '" << fileName << "' indexed." << endl;
+        } else if (removeDocument(fileName)) {
+            cout << "Document '" << fileName << "' removed from the index." << endl;
+        } else {
+            cout << "Document '" << fileName << "' not found." << endl;
+        }
+    }
+
+    // Applies a batch of changed file names in one update. Files that still exist
+    // are read and analysed in parallel outside the locks; the batch then goes in
+    // under a single exclusive section. Returns the number of documents changed.
+    size_t applyChanges(const vector<string> &fileNames) {
+        vector<DocumentStats> results(fileNames.size());
+        vector<char> present(fileNames.size(), 0);
+        parallelFor(fileNames.size(), threadCount, [&](size_t i) {
+            fs::path path = fs::path(folderPath) / fileNames[i];
+            error_code error;
+            if (!fs::is_regular_file(path, error)) {
                 return;
             }
+            unique_ptr<MappedFile> file;
+            {
+                METRIC_TIMER(STAGE_INDEX_READ);
+                file = make_unique<MappedFile>(path.string());
+                if (!file->isOpen()) {
+                    return;
+                }
+            }
+            METRIC_TIMER(STAGE_INDEX_ANALYZE);
+            METRIC_COUNT(COUNTER_DOCUMENTS_INDEXED, 1);
+            METRIC_COUNT(COUNTER_BYTES_INDEXED, file->view().size());
+            results[i] = analyzeDocument(fileNames[i], file->view());
+            present[i] = 1;
+        });
+
+        size_t changed = 0;
+        bool compactNow;
+        {
+            lock_guard<mutex> writer(updateLock);
+            unique_lock<shared_mutex> exclusive(modelLock);
+            METRIC_TIMER(STAGE_INDEX_MERGE);
+            for (size_t i = 0; i < fileNames.size(); i++) {
+                auto it = liveIds.find(fileNames[i]);
+                bool indexed = it != liveIds.end();
+                if (indexed) {
+                    retireDocument(it->second);
+                }
+                if (present[i]) {
+                    addDocument(move(results[i]));
+                }
+                changed += indexed || present[i];
+            }
+            compactNow = needsCompaction();
         }
-        cout << "Document '" << docName << "' not found." << endl;
+        if (compactNow) {
+            startCompaction();
+        }
+        return changed;
     }
-    
-    void searchByKeyword(const string &query) {
-        unordered_map<string, float> queryVector;
-        vector<string> queryTokens = tokenize(query);
-        unordered_map<string, int> queryFrequency;
 
-        for (const string &token : queryTokens) {
-            queryFrequency[token]++;
+    vector<string> indexedDocuments() const {
+        shared_lock<shared_mutex> reader(modelLock);
+        return documentNames.all();
+    }
+
+    const string &folder() const {
+        return folderPath;
+    }
+
+    uint64_t cacheHits() const {
+        return keywordCache.hitCount();
+    }
+
+    uint64_t cacheMisses() const {
+        return keywordCache.missCount();
+    }
+
+    void printCacheStats() const {
+        cout << "Keyword cache: " << cacheHits() << " hits, " << cacheMisses() << " misses" << endl;
+    }
+    // Returns the stored name that matches docName once extensions are ignored,
+    // or an empty string if no document does
+    string findDocumentName(const string &docName) const {
+        shared_lock<shared_mutex> reader(modelLock);
+        vector<string> found = documentNames.withStem(docName, 1);
+        return found.empty() ? "" : found[0];
+    }
+
+    // Up to limit indexed names containing text; a trailing '*' asks for names
+    // starting with the rest instead
+    vector<string> matchDocumentNames(const string &text, size_t limit) const {
+        shared_lock<shared_mutex> reader(modelLock);
+        if (!text.empty() && text.back() == '*') {
+            return documentNames.withPrefix(text.substr(0, text.size() - 1), limit);
         }
+        return documentNames.containing(text, limit);
+    }
 
-        for (const auto &[term, freq] : queryFrequency) {
-            queryVector[term] = 0.5 + 0.5 * freq; // Simple TF
+    void searchByDocumentName(const string &docName) const {
+        string storedDocName = findDocumentName(docName);
+        if (!storedDocName.empty()) {
+            cout << "Document '" << storedDocName << "' found." << endl;
+            return;
+        }
+        vector<string> matches = matchDocumentNames(docName, 10);
+        if (matches.empty()) {
+            cout << "Document '" << docName << "' not found." << endl;
+        } else {
+            cout << "No document named '" << docName << "'; names matching it:" << endl;
+            for (const string &name : matches) {
+                cout << name << endl;
+            }
+        }
+    }
+    
+    // Walks only the postings of the query terms and returns the k documents with
+    // the highest cosine similarity, best first. Repeated queries are answered from
+    // keywordCache; the ranking only depends on the multiset of query tokens and k,
+    // so the sorted tokens form the cache key.
+    vector<pair<string, float>> searchByKeyword(const string &query, size_t k) const {
+        METRIC_COUNT(COUNTER_KEYWORD_QUERIES, 1);
+        vector<string> queryTokens;
+        string cacheKey = to_string(k);
+        {
+            METRIC_TIMER(STAGE_TOKENIZE);
+            queryTokens = tokenize(query);
+            sort(queryTokens.begin(), queryTokens.end());
+            for (const string &token : queryTokens) {
+                cacheKey += ' ' + token;
+            }
         }
 
+        shared_lock<shared_mutex> reader(modelLock, defer_lock);
+        {
+            METRIC_TIMER(STAGE_LOCK_WAIT);
+            reader.lock();
+        }
         vector<pair<string, float>> rankings;
+        {
+            METRIC_TIMER(STAGE_CACHE);
+            if (keywordCache.lookup(cacheKey, rankings, generation)) {
+                return rankings;
+            }
+        }
+        vector<pair<uint32_t, float>> topDocs;
+        {
+            METRIC_TIMER(STAGE_SCORE);
+            vector<TermCursor> cursors;
+            for (const auto &[termId, weight] : queryWeights(queryTokens)) {
+                cursors.push_back({&postings[termId], 0, weight * maxWeight[termId], weight});
+            }
+            auto cosine = [](uint32_t, const vector<const TermCursor *> &matched) {
+                METRIC_COUNT(COUNTER_DOCUMENTS_SCORED, 1);
+                float score = 0.0f;
+                for (const TermCursor *cursor : matched) {
+                    score += cursor->weight * cursor->posting().weight;
+                }
+                return score;
+            };
+            topDocs = wandTopK(move(cursors), k, cosine, [&](uint32_t docId) { return deleted[docId] != 0; });
+        }
+
+        METRIC_TIMER(STAGE_CACHE);
+        for (const auto &[docId, similarity] : topDocs) {
+            rankings.emplace_back(documentIds[docId], similarity);
+        }
+        keywordCache.insert(cacheKey, rankings, generation);
+        return rankings;
+    }
+
+    // Ranks many keyword queries at once and returns the top k of each, in input
+    // order. Queries are sorted by their term ids so that neighbours share terms,
+    // then cut into groups that are scored term-at-a-time on threadCount workers:
+    // each postings list a group needs is read once and its entries are added to
+    // the accumulators of every query in the group that has the term. Groups are
+    // sized to keep their dense accumulators around 4 MB.
+    vector<vector<pair<string, float>>> searchBatch(const vector<string> &queries, size_t k) const {
+        METRIC_COUNT(COUNTER_BATCH_QUERIES, queries.size());
+        shared_lock<shared_mutex> reader(modelLock);
+        vector<vector<pair<uint32_t, float>>> weights(queries.size());
+        parallelFor(queries.size(), threadCount, [&](size_t q) {
+            METRIC_TIMER(STAGE_TOKENIZE);
+            weights[q] = queryWeights(tokenize(queries[q]));
+        });
+        vector<size_t> order(queries.size());
+        for (size_t q = 0; q < order.size(); q++) {
+            order[q] = q;
+        }
+        {
+            METRIC_TIMER(STAGE_SORT);
+            stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return weights[a] < weights[b]; });
+        }
+
+        size_t docCount = max<size_t>(1, documentIds.size());
+        size_t groupSize = min<size_t>(256, max<size_t>(1, (1 << 20) / docCount));
+        size_t groupCount = (order.size() + groupSize - 1) / groupSize;
+        vector<vector<pair<string, float>>> results(queries.size());
+        parallelFor(groupCount, threadCount, [&](size_t group) {
+            size_t first = group * groupSize, count = min(groupSize, order.size() - first);
+
+            // (term id, query within the group, weight), grouped by term
+            vector<tuple<uint32_t, size_t, float>> terms;
+            for (size_t q = 0; q < count; q++) {
+                for (const auto &[termId, weight] : weights[order[first + q]]) {
+                    terms.emplace_back(termId, q, weight);
+                }
+            }
+            sort(terms.begin(), terms.end());
 
-        for (const auto &[docName, vector] : documentVectors) {
-            float similarity = cosineSimilarity(queryVector, vector);
-            rankings.emplace_back(docName, similarity);
+            METRIC_TIMER(STAGE_SCORE);
+            vector<float> scores(count * docCount, 0.0f);
+            vector<vector<uint32_t>> touched(count);
+            for (size_t run = 0; run < terms.size();) {
+                size_t runEnd = run;
+                while (runEnd < terms.size() && get<0>(terms[runEnd]) == get<0>(terms[run])) {
+                    runEnd++;
+                }
+                for (const Posting &posting : postings[get<0>(terms[run])]) {
+                    if (deleted[posting.doc]) {
+                        continue;
+                    }
+                    for (size_t i = run; i < runEnd; i++) {
+                        float &score = scores[get<1>(terms[i]) * docCount + posting.doc];
+                        if (score == 0.0f) {
+                            touched[get<1>(terms[i])].push_back(posting.doc);
+                        }
+                        score += get<2>(terms[i]) * posting.weight;
+                    }
+                }
+                run = runEnd;
+            }
+
+            for (size_t q = 0; q < count; q++) {
+                float *queryScores = scores.data() + q * docCount;
+                vector<uint32_t> &docs = touched[q];
+                size_t shown = min(k, docs.size());
+                partial_sort(docs.begin(), docs.begin() + shown, docs.end(), [&](uint32_t a, uint32_t b) {
+                    return queryScores[a] != queryScores[b] ? queryScores[a] > queryScores[b] : a < b;
+                });
+                vector<pair<string, float>> &rankings = results[order[first + q]];
+                for (size_t i = 0; i < shown; i++) {
+                    rankings.emplace_back(documentIds[docs[i]], queryScores[docs[i]]);
+                }
+            }
+        });
+        return results;
+    }
+
+    // Ranks the other documents by the cosine similarity of their vectors to the
+    // named document's vector. Fills similar with the k best that have a positive
+    // similarity; returns false if the document is not indexed.
+    bool similarDocuments(const string &docName, size_t k, vector<pair<string, float>> &similar) const {
+        METRIC_COUNT(COUNTER_SIMILAR_QUERIES, 1);
+        shared_lock<shared_mutex> reader(modelLock, defer_lock);
+        {
+            METRIC_TIMER(STAGE_LOCK_WAIT);
+            reader.lock();
         }
+        auto it = liveIds.find(docName);
+        if (it == liveIds.end()) {
+            return false;
+        }
+        size_t target = it->second;
 
-        sort(rankings.begin(), rankings.end(), [](const auto &a, const auto &b) {
-            return a.second > b.second;
+        vector<pair<float, size_t>> rankings;
+        {
+            METRIC_TIMER(STAGE_SCORE);
+            METRIC_COUNT(COUNTER_DOCUMENTS_SCORED, documentVectors.size() - deletedCount);
+            for (size_t docId = 0; docId < documentVectors.size(); docId++) {
+                if (docId != target && !deleted[docId]) {
+                    rankings.emplace_back(cosineSimilarity(documentVectors[target], documentVectors[docId]), docId);
+                }
+            }
+        }
+        METRIC_TIMER(STAGE_SORT);
+        size_t shown = min(k, rankings.size());
+        partial_sort(rankings.begin(), rankings.begin() + shown, rankings.end(), [](const auto &a, const auto &b) {
+            return a.first != b.first ? a.first > b.first : a.second < b.second;
         });
 
+        similar.clear();
+        for (size_t i = 0; i < shown && rankings[i].first > 0; i++) {
+            similar.emplace_back(documentIds[rankings[i].second], rankings[i].first);
+        }
+        return true;
+    }
+
+    void searchSimilarDocuments(const string &docName) const {
+        vector<pair<string, float>> similar;
+        if (!similarDocuments(docName, 10, similar)) {
+            cout << "Document '" << docName << "' not found." << endl;
+            return;
+        }
+        cout << "Documents most similar to '" << docName << "':" << endl;
+        for (const auto &[similarName, similarity] : similar) {
+            cout << similarName << " (Similarity: " << similarity << ")" << endl;
+        }
+    }
+
+    // Times the map-based cosineSimilarity against the sparse kernel over pairs
+    // of indexed documents and reports the largest difference between the two
+    void benchmarkCosine() const {
+        shared_lock<shared_mutex> reader(modelLock);
+        vector<unordered_map<uint32_t, float>> maps;
+        for (const SparseVector &vector : documentVectors) {
+            unordered_map<uint32_t, float> &map = maps.emplace_back();
+            for (size_t i = 0; i < vector.terms.size(); i++) {
+                map[vector.terms[i]] = vector.weights[i];
+            }
+        }
+        size_t count = min<size_t>(documentVectors.size(), 200);
+        size_t pairs = count * count;
+        if (pairs == 0) {
+            cout << "No documents indexed." << endl;
+            return;
+        }
+
+        vector<float> expected(pairs);
+        auto start = chrono::steady_clock::now();
+        for (size_t a = 0; a < count; a++) {
+            for (size_t b = 0; b < count; b++) {
+                expected[a * count + b] = cosineSimilarity(maps[a], maps[b]);
+            }
+        }
+        double mapSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        float maxError = 0.0f;
+        vector<float> actual(pairs);
+        start = chrono::steady_clock::now();
+        for (size_t a = 0; a < count; a++) {
+            for (size_t b = 0; b < count; b++) {
+                actual[a * count + b] = cosineSimilarity(documentVectors[a], documentVectors[b]);
+            }
+        }
+        double sparseSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        for (size_t i = 0; i < pairs; i++) {
+            maxError = max(maxError, fabs(actual[i] - expected[i]));
+        }
+
+        cout << pairs << " document pairs, max difference " << maxError << endl;
+        cout << "unordered_map cosine: " << mapSeconds * 1e9 / pairs << " ns/pair" << endl;
+        cout << "SparseVector cosine: " << sparseSeconds * 1e9 / pairs << " ns/pair" << endl;
+    }
+
+    void searchByKeyword(const string &query) const {
+        vector<pair<string, float>> rankings = searchByKeyword(query, 10);
+
         cout << "Documents ranked by relevance:" << endl;
         for (const auto &[docName, similarity] : rankings) {
             if (similarity > 0) {
@@ -127,18 +987,769 @@ public:
     }
 };
 
-int main() {
+// Keeps a GeneralizedVectorModel in step with its folder from a background
+// thread. On Linux the folder is watched with inotify; elsewhere, or if inotify
+// is unavailable, it is polled for changed sizes and modification times. Changed
+// names are collected until the folder has been quiet for debounceDelay (or
+// maxBatchDelay has passed) and then applied to the model as one batch, so a file
+// written in several steps is only re-indexed once.
+class FolderWatcher {
+private:
+    using Clock = chrono::steady_clock;
+    using FileState = pair<fs::file_time_type, uintmax_t>;
+
+    GeneralizedVectorModel &model;
+    thread worker;
+    atomic<bool> running{false};
+    int inotifyFd = -1;
+    map<string, FileState> snapshot;                        // polling: last seen state of each file
+
+    const chrono::milliseconds debounceDelay{300};
+    const chrono::milliseconds maxBatchDelay{2000};
+    const chrono::milliseconds pollInterval{1000};
+
+    map<string, FileState> scanFolder() const {
+        map<string, FileState> files;
+        error_code error;
+        for (const auto &entry : fs::directory_iterator(model.folder(), error)) {
+            if (entry.is_regular_file(error)) {
+                files[entry.path().filename().string()] = {entry.last_write_time(error), entry.file_size(error)};
+            }
+        }
+        return files;
+    }
+
+    // Every file on disk and every indexed document; used when events were lost
+    void addEverything(set<string> &pending) const {
+        for (const auto &[name, state] : scanFolder()) {
+            pending.insert(name);
+        }
+        for (const string &name : model.indexedDocuments()) {
+            pending.insert(name);
+        }
+    }
+
+    // Waits up to about 100ms for changes and adds their file names to pending.
+    // Returns true if anything changed.
+    bool waitForChanges(set<string> &pending, Clock::time_point &lastPoll) {
+#ifdef __linux__
+        if (inotifyFd >= 0) {
+            pollfd descriptor{inotifyFd, POLLIN, 0};
+            if (poll(&descriptor, 1, 100) <= 0) {
+                return false;
+            }
+            alignas(inotify_event) char buffer[16384];
+            bool changed = false;
+            ssize_t length;
+            while ((length = read(inotifyFd, buffer, sizeof(buffer))) > 0) {
+                for (char *cursor = buffer; cursor < buffer + length;) {
+                    const inotify_event *event = reinterpret_cast<const inotify_event *>(cursor);
+                    if (event->mask & IN_Q_OVERFLOW) {
+                        addEverything(pending);
+                        changed = true;
+                    } else if (event->len > 0 && !(event->mask & IN_ISDIR)) {
+                        pending.insert(event->name);
+                        changed = true;
+                    }
+                    cursor += sizeof(inotify_event) + event->len;
+                }
+            }
+            return changed;
+        }
+#endif
+        this_thread::sleep_for(chrono::milliseconds(100));
+        if (Clock::now() - lastPoll < pollInterval) {
+            return false;
+        }
+        lastPoll = Clock::now();
+        map<string, FileState> current = scanFolder();
+        bool changed = false;
+        for (const auto &[name, state] : current) {
+            auto it = snapshot.find(name);
+            if (it == snapshot.end() || it->second != state) {
+                pending.insert(name);
+                changed = true;
+            }
+        }
+        for (const auto &[name, state] : snapshot) {
+            if (!current.count(name)) {
+                pending.insert(name);
+                changed = true;
+            }
+        }
+        snapshot.swap(current);
+        return changed;
+    }
+
+    void run() {
+        set<string> pending;
+        Clock::time_point firstChange, lastChange, lastPoll = Clock::now();
+        while (running) {
+            if (waitForChanges(pending, lastPoll)) {
+                lastChange = Clock::now();
+                if (firstChange == Clock::time_point()) {
+                    firstChange = lastChange;
+                }
+            }
+            Clock::time_point now = Clock::now();
+            if (!pending.empty() && (now - lastChange >= debounceDelay || now - firstChange >= maxBatchDelay)) {
+                size_t changed = model.applyChanges(vector<string>(pending.begin(), pending.end()));
+                if (changed > 0) {
+                    cerr << "[watch] " << changed << " document(s) updated" << endl;
+                }
+                pending.clear();
+                firstChange = Clock::time_point();
+            }
+        }
+    }
+
+public:
+    explicit FolderWatcher(GeneralizedVectorModel &watchedModel) : model(watchedModel) {}
+
+    ~FolderWatcher() {
+        stop();
+    }
+
+    // Call after the initial indexDocuments()
+    void start() {
+#ifdef __linux__
+        inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        uint32_t events = IN_CREATE | IN_MODIFY | IN_CLOSE_WRITE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO;
+        if (inotifyFd >= 0 && inotify_add_watch(inotifyFd, model.folder().c_str(), events) < 0) {
+            close(inotifyFd);
+            inotifyFd = -1;
+        }
+#endif
+        snapshot = scanFolder();
+        running = true;
+        worker = thread(&FolderWatcher::run, this);
+    }
+
+    void stop() {
+        running = false;
+        if (worker.joinable()) {
+            worker.join();
+        }
+#ifdef __linux__
+        if (inotifyFd >= 0) {
+            close(inotifyFd);
+            inotifyFd = -1;
+        }
+#endif
+    }
+};
+
+#ifndef _WIN32
+// Buffered line reads and complete writes over a connected socket
+class LineSocket {
+public:
+    explicit LineSocket(int fd) : fd(fd) {}
+
+    int descriptor() const { return fd; }
+
+    // Returns false once the peer has closed the connection or sent a line
+    // longer than MAX_LINE
+    bool readLine(string &line) {
+        while (!takeLine(line)) {
+            if (!fill()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Takes the next complete line out of the buffer without reading more
+    bool takeLine(string &line) {
+        size_t newline = buffer.find('\n', start);
+        if (newline == string::npos) {
+            return false;
+        }
+        line.assign(buffer, start, newline - start);
+        start = newline + 1;
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        return true;
+    }
+
+    // Reads once from the socket into the buffer; blocks only when nothing has
+    // arrived. Returns false like readLine.
+    bool fill() {
+        buffer.erase(0, start);
+        start = 0;
+        if (buffer.size() > MAX_LINE) {
+            return false;
+        }
+        char chunk[4096];
+        ssize_t received;
+        do {
+            received = recv(fd, chunk, sizeof(chunk), 0);
+        } while (received < 0 && errno == EINTR);
+        if (received <= 0) {
+            return false;
+        }
+        buffer.append(chunk, received);
+        return true;
+    }
+
+    bool writeAll(const string &data) {
+        size_t sent = 0;
+        while (sent < data.size()) {
+            ssize_t written = send(fd, data.data() + sent, data.size() - sent, 0);
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                return false;
+            }
+            sent += written;
+        }
+        return true;
+    }
+
+private:
+    static constexpr size_t MAX_LINE = 1 << 20;
+    int fd;
+    string buffer;
+    size_t start = 0;                                       // unread data begins here
+};
+
+// Opens a stream socket for address, which is "unix:<path>" or "[host:]port"
+// with the host defaulting to 127.0.0.1, and either listens on it or connects
+// to it. Returns -1 after printing the reason on failure.
+int openSocket(const string &address, bool listening) {
+    int fd = -1;
+    if (address.rfind("unix:", 0) == 0) {
+        string path = address.substr(5);
+        sockaddr_un local{};
+        local.sun_family = AF_UNIX;
+        if (path.empty() || path.size() >= sizeof(local.sun_path)) {
+            cerr << "Error: bad socket path '" << path << "'" << endl;
+            return -1;
+        }
+        path.copy(local.sun_path, path.size());
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listening) {
+            unlink(path.c_str());
+        }
+        const sockaddr *target = reinterpret_cast<const sockaddr *>(&local);
+        if (fd < 0 || (listening ? bind(fd, target, sizeof(local)) != 0 || listen(fd, SOMAXCONN) != 0
+                                 : connect(fd, target, sizeof(local)) != 0)) {
+            cerr << "Error: " << address << ": " << strerror(errno) << endl;
+            if (fd >= 0) {
+                close(fd);
+            }
+            return -1;
+        }
+        return fd;
+    }
+
+    size_t colon = address.rfind(':');
+    string host = colon == string::npos ? "127.0.0.1" : address.substr(0, colon);
+    string port = colon == string::npos ? address : address.substr(colon + 1);
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *found = nullptr;
+    int status = getaddrinfo(host.c_str(), port.c_str(), &hints, &found);
+    if (status != 0) {
+        cerr << "Error: " << address << ": " << gai_strerror(status) << endl;
+        return -1;
+    }
+    for (addrinfo *candidate = found; candidate != nullptr; candidate = candidate->ai_next) {
+        fd = socket(candidate->ai_family, candidate->ai_socktype, candidate->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        int enable = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+        if (listening) {
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+            if (bind(fd, candidate->ai_addr, candidate->ai_addrlen) == 0 && listen(fd, SOMAXCONN) == 0) {
+                break;
+            }
+        } else if (connect(fd, candidate->ai_addr, candidate->ai_addrlen) == 0) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(found);
+    if (fd < 0) {
+        cerr << "Error: " << address << ": " << strerror(errno) << endl;
+    }
+    return fd;
+}
+
+// Serves queries against a shared model over a line protocol. Each request is
+// one line; the reply is "OK <n>" followed by n result lines, or one "ERR" line.
+//   KEYWORD <k> <query>   top k documents for the query: name<TAB>similarity
+//   SIMILAR <k> <name>    top k documents most similar to the named one
+//   NAME <name>           the indexed name matching <name>, ignoring extensions
+//   MATCH <k> <text>      up to k indexed names containing <text>, or starting
+//                         with it when it ends in '*'
+//   STATS                 keyword cache hits and misses
+//   TRACE <query>         stage breakdown of one top-10 keyword query (-DIR_METRICS)
+//   METRICS               all metrics in the Prometheus text format (-DIR_METRICS)
+// The calling thread accepts connections and polls the idle ones. A connection
+// with data is handed to a fixed pool of workers, which answers the requests
+// it has received so far and gives it back to be polled again. Workers never
+// wait on a client, so any number of connections share workerCount workers;
+// queries share the model's read lock.
+class QueryServer {
+public:
+    QueryServer(const GeneralizedVectorModel &model, unsigned workers) : model(model), workerCount(max(1u, workers)) {}
+
+    // Runs until the process is stopped; returns false if address cannot be opened
+    bool serve(const string &address) {
+        int listener = openSocket(address, true);
+        if (listener < 0) {
+            return false;
+        }
+        // Workers wake poll() through a pipe; a full pipe already wakes it, so
+        // neither end ever blocks
+        int wake[2];
+        if (pipe(wake) != 0) {
+            cerr << "Error: pipe: " << strerror(errno) << endl;
+            close(listener);
+            return false;
+        }
+        fcntl(wake[0], F_SETFL, O_NONBLOCK);
+        fcntl(wake[1], F_SETFL, O_NONBLOCK);
+        wakeFd = wake[1];
+        signal(SIGPIPE, SIG_IGN);
+        cout << "Serving on " << address << " with " << workerCount << " workers" << endl;
+
+        vector<thread> workers;
+        for (unsigned i = 0; i < workerCount; i++) {
+            workers.emplace_back(&QueryServer::work, this);
+        }
+        unordered_map<int, unique_ptr<LineSocket>> connections;
+        vector<int> idle;                                   // connections no worker holds
+        vector<pollfd> watched;
+        vector<pair<LineSocket *, bool>> done;
+        while (true) {
+            watched.assign({{listener, POLLIN, 0}, {wake[0], POLLIN, 0}});
+            for (int fd : idle) {
+                watched.push_back({fd, POLLIN, 0});
+            }
+            if (poll(watched.data(), watched.size(), -1) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                cerr << "Error: poll: " << strerror(errno) << endl;
+                break;
+            }
+
+            // Connections with data go to the workers; the rest stay idle
+            size_t ready = 0;
+            {
+                lock_guard<mutex> guard(pendingLock);
+                idle.clear();
+                for (size_t i = 2; i < watched.size(); i++) {
+                    if (watched[i].revents == 0) {
+                        idle.push_back(watched[i].fd);
+                    } else {
+                        pending.push(connections[watched[i].fd].get());
+                        ready++;
+                    }
+                }
+            }
+            for (; ready > 0; ready--) {
+                pendingReady.notify_one();
+            }
+
+            // Connections whose requests have been answered are polled again,
+            // unless they were closed or failed
+            if (watched[1].revents != 0) {
+                char drained[256];
+                while (read(wake[0], drained, sizeof(drained)) == sizeof(drained)) {
+                }
+                {
+                    lock_guard<mutex> guard(pendingLock);
+                    done.swap(answered);
+                }
+                for (const auto &[connection, open] : done) {
+                    int fd = connection->descriptor();
+                    if (open) {
+                        idle.push_back(fd);
+                    } else {
+                        connections.erase(fd);
+                        close(fd);
+                    }
+                }
+                done.clear();
+            }
+
+            if (watched[0].revents != 0) {
+                int client = accept(listener, nullptr, nullptr);
+                if (client >= 0) {
+                    connections[client] = make_unique<LineSocket>(client);
+                    idle.push_back(client);
+                } else if (errno != EINTR && errno != ECONNABORTED) {
+                    cerr << "Error: accept: " << strerror(errno) << endl;
+                    break;
+                }
+            }
+        }
+        close(listener);
+        {
+            lock_guard<mutex> guard(pendingLock);
+            stopping = true;
+        }
+        pendingReady.notify_all();
+        for (auto &worker : workers) {
+            worker.join();
+        }
+        for (const auto &entry : connections) {
+            close(entry.first);
+        }
+        close(wake[0]);
+        close(wake[1]);
+        return true;
+    }
+
+private:
+    const GeneralizedVectorModel &model;
+    unsigned workerCount;
+    queue<LineSocket *> pending;                            // connections with data, waiting for a worker
+    vector<pair<LineSocket *, bool>> answered;              // handed back by workers, and whether still open
+    mutex pendingLock;
+    condition_variable pendingReady;
+    bool stopping = false;
+    int wakeFd = -1;                                        // written to when a connection is handed back
+
+    void work() {
+        string request, reply;
+        while (true) {
+            LineSocket *connection;
+            {
+                unique_lock<mutex> guard(pendingLock);
+                pendingReady.wait(guard, [this]() { return stopping || !pending.empty(); });
+                if (pending.empty()) {
+                    return;
+                }
+                connection = pending.front();
+                pending.pop();
+            }
+            // poll() saw data, so this read does not block; a request split
+            // across reads waits in the buffer for its next poll
+            bool open = connection->fill();
+            while (open && connection->takeLine(request)) {
+                reply.clear();
+                answer(request, reply);
+                open = connection->writeAll(reply);
+            }
+            {
+                lock_guard<mutex> guard(pendingLock);
+                answered.emplace_back(connection, open);
+            }
+            char byte = 0;
+            if (write(wakeFd, &byte, 1) < 0 && errno != EAGAIN) {
+                cerr << "Error: wake: " << strerror(errno) << endl;
+            }
+        }
+    }
+
+    static void appendResults(const vector<pair<string, float>> &results, string &reply) {
+        reply += "OK " + to_string(results.size()) + "\n";
+        for (const auto &[docName, similarity] : results) {
+            reply += docName + "\t" + to_string(similarity) + "\n";
+        }
+    }
+
+    void answer(const string &request, string &reply) const {
+        istringstream fields(request);
+        string command, argument;
+        fields >> command;
+        size_t k = 0;
+        if (command == "KEYWORD" || command == "SIMILAR" || command == "MATCH") {
+            if (!(fields >> k) || k == 0 || k > 1000) {
+                reply += "ERR k must be between 1 and 1000\n";
+                return;
+            }
+        }
+        getline(fields >> ws, argument);
+
+        if (command == "KEYWORD") {
+            appendResults(model.searchByKeyword(argument, k), reply);
+        } else if (command == "SIMILAR") {
+            vector<pair<string, float>> similar;
+            if (model.similarDocuments(argument, k, similar)) {
+                appendResults(similar, reply);
+            } else {
+                reply += "ERR document '" + argument + "' not found\n";
+            }
+        } else if (command == "NAME") {
+            string storedDocName = model.findDocumentName(argument);
+            reply += storedDocName.empty() ? "OK 0\n" : "OK 1\n" + storedDocName + "\n";
+        } else if (command == "MATCH") {
+            vector<string> names = model.matchDocumentNames(argument, k);
+            reply += "OK " + to_string(names.size()) + "\n";
+            for (const string &name : names) {
+                reply += name + "\n";
+            }
+        } else if (command == "STATS") {
+            reply += "OK 1\nhits " + to_string(model.cacheHits()) + " misses " + to_string(model.cacheMisses()) + "\n";
+        } else if (command == "TRACE") {
+            QueryTrace trace;
+            size_t count = model.searchByKeyword(argument, 10).size();
+            reply += "OK 1\n" + to_string(count) + " results: " + trace.format() + "\n";
+        } else if (command == "METRICS") {
+            string text = metricsText();
+            reply += "OK " + to_string(count(text.begin(), text.end(), '\n')) + "\n" + text;
+        } else {
+            reply += "ERR unknown command '" + command + "'\n";
+        }
+    }
+};
+
+// Load generator for QueryServer: `connections` clients each send the requests
+// of requestFile in turn, starting at different lines, for `seconds`, then the
+// throughput and latency percentiles over all of them are reported
+void runLoadGenerator(const string &address, unsigned connections, double seconds, const string &requestFile) {
+    vector<string> requests;
+    ifstream file(requestFile);
+    for (string line; getline(file, line);) {
+        if (!line.empty()) {
+            requests.push_back(line + "\n");
+        }
+    }
+    if (requests.empty()) {
+        cerr << "Error: no requests in '" << requestFile << "'" << endl;
+        return;
+    }
+
+    auto deadline = chrono::steady_clock::now() + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(seconds));
+    vector<vector<float>> latencies(connections);         // microseconds, per client
+    atomic<size_t> errors{0}, failedClients{0};
+    vector<thread> clients;
+    for (unsigned c = 0; c < connections; c++) {
+        clients.emplace_back([&, c]() {
+            int fd = openSocket(address, false);
+            if (fd < 0) {
+                failedClients++;
+                return;
+            }
+            LineSocket connection(fd);
+            string line;
+            for (size_t next = c * requests.size() / connections; chrono::steady_clock::now() < deadline; next++) {
+                auto start = chrono::steady_clock::now();
+                if (!connection.writeAll(requests[next % requests.size()]) || !connection.readLine(line)) {
+                    failedClients++;
+                    break;
+                }
+                if (line.rfind("OK ", 0) == 0) {
+                    for (long lines = atol(line.c_str() + 3); lines > 0 && connection.readLine(line); lines--) {
+                    }
+                } else {
+                    errors++;
+                }
+                latencies[c].push_back(chrono::duration<float, micro>(chrono::steady_clock::now() - start).count());
+            }
+            close(fd);
+        });
+    }
+    for (auto &client : clients) {
+        client.join();
+    }
+
+    vector<float> all;
+    for (const auto &clientLatencies : latencies) {
+        all.insert(all.end(), clientLatencies.begin(), clientLatencies.end());
+    }
+    if (all.empty()) {
+        cerr << "Error: no requests completed" << endl;
+        return;
+    }
+    sort(all.begin(), all.end());
+    auto percentile = [&](double p) { return all[min(all.size() - 1, static_cast<size_t>(p * all.size()))]; };
+    cout << all.size() << " requests over " << connections << " connections in " << seconds << " s: "
+         << all.size() / seconds << " QPS" << endl;
+    cout << "latency us: p50 " << percentile(0.5) << ", p90 " << percentile(0.9) << ", p99 " << percentile(0.99)
+         << ", max " << all.back() << endl;
+    if (errors > 0 || failedClients > 0) {
+        cout << errors << " error replies, " << failedClients << " connection failures" << endl;
+    }
+}
+#endif
+
+// Runs every query of queryFile through searchBatch and writes the rankings to
+// outputFile, as a TREC run ("qid Q0 doc rank score run") or as TSV
+// ("qid<TAB>doc<TAB>rank<TAB>score"). A query line is "qid<TAB>text", or just
+// the text, in which case its line number is the qid.
+void runBatch(const GeneralizedVectorModel &gvm, const string &queryFile, const string &outputFile, const string &format,
+              size_t k) {
+    vector<string> ids, queries;
+    ifstream input(queryFile);
+    if (!input.is_open()) {
+        cerr << "Error: Could not open " << queryFile << endl;
+        return;
+    }
+    size_t lineNumber = 0;
+    for (string line; getline(input, line);) {
+        lineNumber++;
+        if (line.empty()) {
+            continue;
+        }
+        size_t tab = line.find('\t');
+        ids.push_back(tab == string::npos ? to_string(lineNumber) : line.substr(0, tab));
+        queries.push_back(tab == string::npos ? line : line.substr(tab + 1));
+    }
+
+    auto start = chrono::steady_clock::now();
+    vector<vector<pair<string, float>>> results = gvm.searchBatch(queries, k);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    ofstream output(outputFile);
+    for (size_t q = 0; q < results.size(); q++) {
+        for (size_t rank = 0; rank < results[q].size(); rank++) {
+            const auto &[docName, similarity] = results[q][rank];
+            if (format == "trec") {
+                output << ids[q] << " Q0 " << docName << ' ' << rank + 1 << ' ' << similarity << " gvm\n";
+            } else {
+                output << ids[q] << '\t' << docName << '\t' << rank + 1 << '\t' << similarity << '\n';
+            }
+        }
+    }
+    cout << queries.size() << " queries in " << seconds << " s: " << queries.size() / seconds << " queries/s" << endl;
+}
+
+// Times indexing the folder and then searchByKeyword on every line of queryFile.
+// The model should be built without a keyword cache so that every query is
+// computed.
+void benchmarkQueries(GeneralizedVectorModel &gvm, const string &queryFile) {
+    uint64_t bytes = 0;
+    for (const auto &entry : fs::directory_iterator(gvm.folder())) {
+        if (entry.is_regular_file()) {
+            bytes += entry.file_size();
+        }
+    }
+    auto start = chrono::steady_clock::now();
+    gvm.indexDocuments();
+    reportIndexing(gvm.indexedDocuments().size(), bytes, chrono::duration<double>(chrono::steady_clock::now() - start).count());
+
+    size_t results = 0;
+    timeQueries("keyword", readBenchQueries(queryFile), [&](const string &query) {
+        results += gvm.searchByKeyword(query, 10).size();
+    });
+    cout << results << " results in total" << endl;
+}
+
+// Writes the metrics to file on exit when --metrics was given
+void writeMetrics(const string &file) {
+    if (file.empty()) {
+        return;
+    }
+#ifdef IR_METRICS
+    ofstream output(file);
+    output << metricsText();
+    if (!output) {
+        cerr << "Error: could not write metrics to " << file << endl;
+    }
+#else
+    cerr << "Warning: --metrics needs a build with -DIR_METRICS; " << file << " not written" << endl;
+#endif
+}
+
+int main(int argc, char *argv[]) {
     string folderPath = "./";
 
-    GeneralizedVectorModel gvm(folderPath);
+    // --threads <n> sets the number of indexing workers (default: all cores);
+    // --watch keeps the index in step with the folder while the menu runs;
+    // --cache-mb <n> bounds the keyword result cache (default: 16);
+    // --serve <address> [--workers <n>] answers queries over a socket instead of
+    // the menu, on n query workers (default: all cores); --load <address> <connections> <seconds> <request file> drives a
+    // running server; --batch <query file> <output file> [--format trec|tsv]
+    // [--k <n>] ranks a whole query file at once; --bench-queries <query file>
+    // times indexing and uncached keyword queries; --metrics <file> writes the
+    // stage timings and counters there on exit and --trace prints each menu
+    // keyword query's stage breakdown (both need a build with -DIR_METRICS)
+    unsigned threads = max(1u, thread::hardware_concurrency());
+    unsigned workers = threads;
+    size_t cacheBytes = 16 << 20;
+    bool watch = false, benchCosine = false, trace = false;
+    string serveAddress, batchQueries, batchOutput, batchFormat = "trec", benchQueries, metricsFile;
+    size_t batchDepth = 10;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc) {
+            threads = max(1, atoi(argv[++i]));
+        } else if (arg == "--cache-mb" && i + 1 < argc) {
+            cacheBytes = static_cast<size_t>(max(0, atoi(argv[++i]))) << 20;
+        } else if (arg == "--bench-tokenizer" && i + 1 < argc) {
+            benchmarkTokenizer<TokenRule::Whitespace>(argv[++i]);
+            return 0;
+        } else if (arg == "--bench-queries" && i + 1 < argc) {
+            benchQueries = argv[++i];
+        } else if (arg == "--bench-cosine") {
+            benchCosine = true;
+        } else if (arg == "--watch") {
+            watch = true;
+        } else if (arg == "--metrics" && i + 1 < argc) {
+            metricsFile = argv[++i];
+        } else if (arg == "--trace") {
+            trace = true;
+        } else if (arg == "--serve" && i + 1 < argc) {
+            serveAddress = argv[++i];
+        } else if (arg == "--batch" && i + 2 < argc) {
+            batchQueries = argv[++i];
+            batchOutput = argv[++i];
+        } else if (arg == "--format" && i + 1 < argc) {
+            batchFormat = argv[++i];
+        } else if (arg == "--k" && i + 1 < argc) {
+            batchDepth = max(1, atoi(argv[++i]));
+        } else if (arg == "--workers" && i + 1 < argc) {
+            workers = max(1, atoi(argv[++i]));
+        } else if (arg == "--load" && i + 4 < argc) {
+#ifndef _WIN32
+            runLoadGenerator(argv[i + 1], max(1, atoi(argv[i + 2])), atof(argv[i + 3]), argv[i + 4]);
+#else
+            cerr << "Error: --load needs POSIX sockets" << endl;
+#endif
+            return 0;
+        }
+    }
+
+    if (!benchQueries.empty()) {
+        GeneralizedVectorModel uncached(folderPath, threads, 0);
+        benchmarkQueries(uncached, benchQueries);
+        writeMetrics(metricsFile);
+        return 0;
+    }
+
+    GeneralizedVectorModel gvm(folderPath, threads, cacheBytes);
     gvm.indexDocuments();
+    if (benchCosine) {
+        gvm.benchmarkCosine();
+        return 0;
+    }
+    if (!batchQueries.empty()) {
+        runBatch(gvm, batchQueries, batchOutput, batchFormat, batchDepth);
+        writeMetrics(metricsFile);
+        return 0;
+    }
+    FolderWatcher watcher(gvm);
+    if (watch) {
+        watcher.start();
+    }
+    if (!serveAddress.empty()) {
+#ifndef _WIN32
+        return QueryServer(gvm, workers).serve(serveAddress) ? 0 : 1;
+#else
+        cerr << "Error: --serve needs POSIX sockets" << endl;
+        return 1;
+#endif
+    }
 
     while (true) {
         try{
             cout << "\nMenu:" << endl;
             cout << "1. Search by Document Name" << endl;
             cout << "2. Search by Keyword" << endl;
-            cout << "3. Exit" << endl;
+            cout << "3. Find Similar Documents" << endl;
+            cout << "4. Re-index a Document" << endl;
+            cout << "5. Exit" << endl;
 
             int choice;
             cout << "Enter your choice: ";
@@ -154,8 +1765,24 @@ int main() {
                 string keyword;
                 cout << "Enter keyword: ";
                 getline(cin, keyword);
+                QueryTrace breakdown;
                 gvm.searchByKeyword(keyword);
+                if (trace) {
+                    cout << "Breakdown: " << breakdown.format() << endl;
+                }
             } else if (choice == 3) {
+                string docName;
+                cout << "Enter document name: ";
+                getline(cin, docName);
+                gvm.searchSimilarDocuments(docName);
+            } else if (choice == 4) {
+                string docName;
+                cout << "Enter document name: ";
+                getline(cin, docName);
+                gvm.reindexFile(docName);
+            } else if (choice == 5) {
+                gvm.printCacheStats();
+                writeMetrics(metricsFile);
                 cout << "Exiting program." << endl;
                 break;
             } else {
@@ -0,0 +1,292 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <filesystem>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#ifndef _WIN32
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+#include "../common/bench_report.h"
+
+namespace fs = std::filesystem;
+using namespace std;
+
+// Benchmark harness for the retrieval programs of this repository.
+//
+//   benchmark generate <corpus dir> <MB> [options]
+//       writes a synthetic corpus of about <MB> megabytes: documents of roughly
+//       --doc-kb kilobytes whose words are drawn from a Zipf distribution over
+//       a vocabulary of --vocab words with exponent --zipf
+//   benchmark queries <query file> <count> [options]
+//       writes <count> queries of 1-3 words from the same vocabulary, skipping
+//       its 100 most frequent (stop) words
+//   benchmark run <corpus dir> <query file> <program>...
+//       runs each program with --bench-queries <query file> inside the corpus
+//       folder and tabulates what it reports (indexing throughput, per-model
+//       p50/p99 latency and QPS) together with its wall time and peak RSS
+//
+// Options: --doc-kb <n> (default 64), --vocab <n> (default 200000),
+//          --zipf <s> (default 1.0), --seed <n> (default 1)
+//
+// The programs and this harness are built by the top-level CMakeLists.txt,
+//   cmake -S . -B build -DIR_NATIVE=ON && cmake --build build
+// and a scaling sweep is a loop over corpus sizes:
+//   for mb in 1 10 100 1000 10000; do
+//       benchmark generate corpus_$mb $mb && benchmark run corpus_$mb queries.txt ./assignment1 ./ass_5
+//   done
+// The corpus folder must hold nothing but the generated documents, because the
+// programs index every file in their working directory.
+
+struct Options {
+    size_t docKb = 64;
+    size_t vocabulary = 200000;
+    double zipf = 1.0;
+    uint64_t seed = 1;
+};
+
+// Word of a given frequency rank: the rank spelled in base 64 with one syllable
+// per digit, so every rank has a distinct lowercase alphanumeric word
+string wordForRank(size_t rank) {
+    static const char *syllables[64] = {
+        "ka", "lo", "mi", "nu", "pe", "ra", "si", "to", "va", "xe", "zo", "bi", "du", "fa", "ge", "ho",
+        "ji", "ke", "la", "me", "no", "pu", "ri", "sa", "te", "vo", "wi", "ya", "ze", "ba", "de", "fi",
+        "go", "hu", "ja", "ki", "lu", "ma", "ne", "po", "ru", "se", "ti", "ve", "wo", "yu", "zi", "bo",
+        "da", "fe", "gu", "ha", "je", "ko", "li", "mo", "na", "pi", "re", "so", "tu", "vi", "wa", "ye"};
+    string word;
+    rank++;
+    while (rank > 0) {
+        word += syllables[rank % 64];
+        rank /= 64;
+    }
+    return word;
+}
+
+// Samples word ranks with probability proportional to 1 / (rank + 1)^s
+class ZipfSampler {
+public:
+    ZipfSampler(size_t size, double exponent, uint64_t seed) : cumulative(size), random(seed) {
+        double total = 0.0;
+        for (size_t rank = 0; rank < size; rank++) {
+            total += 1.0 / pow(rank + 1.0, exponent);
+            cumulative[rank] = total;
+        }
+        uniform = uniform_real_distribution<double>(0.0, total);
+    }
+
+    size_t next() {
+        size_t rank = upper_bound(cumulative.begin(), cumulative.end(), uniform(random)) - cumulative.begin();
+        return min(rank, cumulative.size() - 1);
+    }
+
+    mt19937_64 &engine() {
+        return random;
+    }
+
+private:
+    vector<double> cumulative;
+    mt19937_64 random;
+    uniform_real_distribution<double> uniform;
+};
+
+bool parseOptions(const vector<string> &args, size_t first, Options &options) {
+    for (size_t i = first; i < args.size(); i += 2) {
+        if (i + 1 >= args.size()) {
+            return false;
+        }
+        if (args[i] == "--doc-kb") {
+            options.docKb = max(1, atoi(args[i + 1].c_str()));
+        } else if (args[i] == "--vocab") {
+            options.vocabulary = max(1, atoi(args[i + 1].c_str()));
+        } else if (args[i] == "--zipf") {
+            options.zipf = atof(args[i + 1].c_str());
+        } else if (args[i] == "--seed") {
+            options.seed = strtoull(args[i + 1].c_str(), nullptr, 10);
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Documents vary between half and one and a half times docKb; words are
+// separated by spaces with a line break after every 12th word
+void generateCorpus(const string &folder, double megabytes, const Options &options) {
+    fs::create_directories(folder);
+    vector<string> words(options.vocabulary);
+    for (size_t rank = 0; rank < words.size(); rank++) {
+        words[rank] = wordForRank(rank);
+    }
+    ZipfSampler sampler(options.vocabulary, options.zipf, options.seed);
+    uniform_real_distribution<double> docScale(0.5, 1.5);
+
+    auto start = chrono::steady_clock::now();
+    uint64_t target = static_cast<uint64_t>(megabytes * 1e6), written = 0;
+    size_t documents = 0;
+    string text;
+    while (written < target) {
+        size_t size = min<uint64_t>(target - written, static_cast<uint64_t>(options.docKb * 1000 * docScale(sampler.engine())));
+        text.clear();
+        for (size_t count = 1; text.size() < size; count++) {
+            text += words[sampler.next()];
+            text += count % 12 == 0 ? '\n' : ' ';
+        }
+        char name[32];
+        snprintf(name, sizeof(name), "doc%07zu.txt", documents++);
+        ofstream(fs::path(folder) / name, ios::binary).write(text.data(), text.size());
+        written += text.size();
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "Wrote " << documents << " documents, " << written / 1e6 << " MB to " << folder << " in " << seconds << " s" << endl;
+}
+
+void generateQueries(const string &file, size_t count, const Options &options) {
+    const size_t STOP_WORDS = 100;
+    ZipfSampler sampler(options.vocabulary, options.zipf, options.seed + 1);
+    uniform_int_distribution<int> length(1, 3);
+    ofstream output(file);
+    for (size_t q = 0; q < count; q++) {
+        int words = length(sampler.engine());
+        for (int w = 0; w < words; w++) {
+            size_t rank;
+            do {
+                rank = sampler.next();
+            } while (rank < STOP_WORDS && options.vocabulary > STOP_WORDS);
+            output << (w > 0 ? " " : "") << wordForRank(rank);
+        }
+        output << '\n';
+    }
+    cout << "Wrote " << count << " queries to " << file << endl;
+}
+
+#ifndef _WIN32
+// Runs program in folder with --bench-queries, echoing its output, and returns
+// the fields of the "bench:" lines it printed; wallSeconds and peakKb describe
+// the whole run
+vector<map<string, string>> runProgram(const string &program, const string &folder, const string &queryFile, double &wallSeconds,
+                          long &peakKb) {
+    int pipeFds[2];
+    if (pipe(pipeFds) != 0) {
+        perror("pipe");
+        return {};
+    }
+    auto start = chrono::steady_clock::now();
+    pid_t child = fork();
+    if (child < 0) {
+        perror("fork");
+        close(pipeFds[0]);
+        close(pipeFds[1]);
+        return {};
+    }
+    if (child == 0) {
+        dup2(pipeFds[1], STDOUT_FILENO);
+        close(pipeFds[0]);
+        close(pipeFds[1]);
+        if (chdir(folder.c_str()) != 0) {
+            perror(folder.c_str());
+            _exit(127);
+        }
+        execl(program.c_str(), program.c_str(), "--bench-queries", queryFile.c_str(), static_cast<char *>(nullptr));
+        perror(program.c_str());
+        _exit(127);
+    }
+    close(pipeFds[1]);
+
+    vector<map<string, string>> reports;
+    string pending;
+    char chunk[4096];
+    ssize_t received;
+    while ((received = read(pipeFds[0], chunk, sizeof(chunk))) > 0) {
+        pending.append(chunk, received);
+        for (size_t newline; (newline = pending.find('\n')) != string::npos; pending.erase(0, newline + 1)) {
+            string line = pending.substr(0, newline);
+            cout << "  " << line << endl;
+            map<string, string> fields = parseBenchLine(line);
+            if (!fields.empty()) {
+                reports.push_back(move(fields));
+            }
+        }
+    }
+    close(pipeFds[0]);
+
+    int status = 0;
+    rusage usage{};
+    wait4(child, &status, 0, &usage);
+    wallSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    peakKb = usage.ru_maxrss;
+#ifdef __APPLE__
+    peakKb /= 1024;  // bytes on macOS
+#endif
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        cerr << program << " did not exit cleanly" << endl;
+    }
+    return reports;
+}
+
+void runBenchmarks(const string &folder, const string &queryFile, const vector<string> &programs) {
+    string queries = fs::absolute(queryFile).string();
+    vector<string> rows;
+    for (const string &program : programs) {
+        string path = fs::absolute(program).string();
+        cout << path << endl;
+        double wallSeconds = 0.0;
+        long peakKb = 0;
+        vector<map<string, string>> reports = runProgram(path, folder, queries, wallSeconds, peakKb);
+
+        string indexRate = "-";
+        for (map<string, string> &fields : reports) {
+            if (fields["kind"] == "index") {
+                double megabytes = atof(fields["bytes"].c_str()) / 1e6;
+                indexRate = to_string(megabytes / atof(fields["seconds"].c_str()));
+            }
+        }
+        string name = fs::path(program).filename().string();
+        for (map<string, string> &fields : reports) {
+            if (fields["kind"] == "query") {
+                rows.push_back(name + "\t" + fields["model"] + "\t" + indexRate + "\t" + fields["p50_us"] + "\t" +
+                               fields["p99_us"] + "\t" + fields["qps"] + "\t" + to_string(peakKb / 1024) + "\t" +
+                               to_string(wallSeconds));
+            }
+        }
+    }
+
+    cout << "\nprogram\tmodel\tindex_MB/s\tp50_us\tp99_us\tQPS\tpeak_RSS_MB\twall_s" << endl;
+    for (const string &row : rows) {
+        cout << row << endl;
+    }
+}
+#endif
+
+int main(int argc, char *argv[]) {
+    vector<string> args(argv + 1, argv + argc);
+    Options options;
+    if (args.size() >= 3 && args[0] == "generate" && parseOptions(args, 3, options)) {
+        generateCorpus(args[1], atof(args[2].c_str()), options);
+    } else if (args.size() >= 3 && args[0] == "queries" && parseOptions(args, 3, options)) {
+        generateQueries(args[1], max(1, atoi(args[2].c_str())), options);
+    } else if (args.size() >= 4 && args[0] == "run") {
+#ifndef _WIN32
+        runBenchmarks(args[1], args[2], vector<string>(args.begin() + 3, args.end()));
+#else
+        cerr << "run needs fork/exec; run the programs with --bench-queries by hand" << endl;
+        return 1;
+#endif
+    } else {
+        cout << "Usage: " << argv[0] << " generate <corpus dir> <MB> [options]\n"
+             << "       " << argv[0] << " queries <query file> <count> [options]\n"
+             << "       " << argv[0] << " run <corpus dir> <query file> <program>...\n"
+             << "Options: --doc-kb <n> --vocab <n> --zipf <s> --seed <n>" << endl;
+        return 1;
+    }
+    return 0;
+}
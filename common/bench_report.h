@@ -0,0 +1,79 @@
+// The "bench:" lines that every program prints under --bench-queries and that
+// Benchmarks/benchmark.cpp tabulates. Both sides include this file, so the
+// format is written and read in one place:
+//
+//   bench: index docs=<n> bytes=<n> seconds=<s>
+//   bench: query model=<name> queries=<n> p50_us=<us> p99_us=<us> qps=<n>
+#ifndef IR_COMMON_BENCH_REPORT_H
+#define IR_COMMON_BENCH_REPORT_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+inline const std::string BENCH_PREFIX = "bench: ";
+
+// The non-empty lines of a query file
+inline std::vector<std::string> readBenchQueries(const std::string& queryFile) {
+    std::vector<std::string> queries;
+    std::ifstream file(queryFile);
+    for (std::string line; std::getline(file, line);) {
+        if (!line.empty()) queries.push_back(line);
+    }
+    return queries;
+}
+
+// Reports how long indexing `documents` documents of `bytes` bytes took
+inline void reportIndexing(size_t documents, uint64_t bytes, double seconds) {
+    std::cout << BENCH_PREFIX << "index docs=" << documents << " bytes=" << bytes << " seconds=" << seconds << std::endl;
+}
+
+// Reports the latency percentiles and throughput of one model from the time
+// each query took, in microseconds
+inline void reportLatencies(const std::string& model, std::vector<double> micros) {
+    if (micros.empty()) return;
+    std::sort(micros.begin(), micros.end());
+    double total = 0.0;
+    for (double m : micros) total += m;
+    std::cout << BENCH_PREFIX << "query model=" << model << " queries=" << micros.size()
+              << " p50_us=" << micros[micros.size() / 2]
+              << " p99_us=" << micros[std::min(micros.size() - 1, micros.size() * 99 / 100)]
+              << " qps=" << micros.size() / (total / 1e6) << std::endl;
+}
+
+// Times run(query) for every query and reports the latencies as model
+template <typename Run>
+void timeQueries(const std::string& model, const std::vector<std::string>& queries, Run run) {
+    std::vector<double> micros;
+    micros.reserve(queries.size());
+    for (const std::string& query : queries) {
+        auto start = std::chrono::steady_clock::now();
+        run(query);
+        micros.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+    }
+    reportLatencies(model, micros);
+}
+
+// Fields of a "bench:" line: "kind" (index or query) and every key=value pair.
+// Any other line gives an empty map.
+inline std::map<std::string, std::string> parseBenchLine(const std::string& line) {
+    std::map<std::string, std::string> fields;
+    if (line.compare(0, BENCH_PREFIX.size(), BENCH_PREFIX) != 0) return fields;
+    std::istringstream in(line.substr(BENCH_PREFIX.size()));
+    std::string field;
+    in >> fields["kind"];
+    while (in >> field) {
+        size_t equals = field.find('=');
+        if (equals != std::string::npos) fields[field.substr(0, equals)] = field.substr(equals + 1);
+    }
+    return fields;
+}
+
+#endif
@@ -0,0 +1,137 @@
+// Document name index shared by the retrieval programs of this repository:
+//
+//   #include "../common/name_index.h"
+#ifndef IR_COMMON_NAME_INDEX_H
+#define IR_COMMON_NAME_INDEX_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// In-memory index of document names. Names with their extension stripped are
+// hashed, and every name is also posted under each of its trigrams: a
+// substring or prefix query intersects the lists of its trigrams, rarest
+// first, and only checks the names left over, so a lookup costs in proportion
+// to the shortest list rather than to the number of names. Queries shorter
+// than a trigram fall back to a scan. A removed name keeps its id and its
+// postings and is revived if it is added again, so updates never have to edit
+// the lists. Every query returns names in the order they were first added.
+class NameIndex {
+public:
+    void add(const std::string& name) {
+        auto it = ids.find(name);
+        if (it != ids.end()) {
+            live[it->second] = 1;
+            return;
+        }
+        uint32_t id = static_cast<uint32_t>(names.size());
+        names.push_back(name);
+        live.push_back(1);
+        ids.emplace(name, id);
+        stems[stripExtension(name)].push_back(id);
+        for (uint32_t trigram : trigramsOf(name)) trigrams[trigram].push_back(id);
+    }
+
+    void remove(const std::string& name) {
+        auto it = ids.find(name);
+        if (it != ids.end()) live[it->second] = 0;
+    }
+
+    bool contains(const std::string& name) const {
+        auto it = ids.find(name);
+        return it != ids.end() && live[it->second];
+    }
+
+    // Up to limit names equal to name once extensions are ignored on both sides
+    std::vector<std::string> withStem(const std::string& name, size_t limit = SIZE_MAX) const {
+        std::vector<std::string> result;
+        auto it = stems.find(stripExtension(name));
+        if (it == stems.end()) return result;
+        for (size_t i = 0; i < it->second.size() && result.size() < limit; i++) {
+            if (live[it->second[i]]) result.push_back(names[it->second[i]]);
+        }
+        return result;
+    }
+
+    // Up to limit names starting with (or containing) text
+    std::vector<std::string> withPrefix(const std::string& text, size_t limit = SIZE_MAX) const {
+        return search(text, limit, [&](const std::string& name) { return name.compare(0, text.size(), text) == 0; });
+    }
+
+    std::vector<std::string> containing(const std::string& text, size_t limit = SIZE_MAX) const {
+        return search(text, limit, [&](const std::string& name) { return name.find(text) != std::string::npos; });
+    }
+
+    std::vector<std::string> all() const {
+        std::vector<std::string> result;
+        for (size_t id = 0; id < names.size(); id++) {
+            if (live[id]) result.push_back(names[id]);
+        }
+        return result;
+    }
+
+    static std::string stripExtension(const std::string& fileName) {
+        size_t lastDot = fileName.find_last_of('.');
+        return lastDot == std::string::npos ? fileName : fileName.substr(0, lastDot);
+    }
+
+private:
+    std::vector<std::string> names;                                  // name id -> name
+    std::vector<char> live;                                          // name id -> not removed
+    std::unordered_map<std::string, uint32_t> ids;
+    std::unordered_map<std::string, std::vector<uint32_t>> stems;    // name without extension -> name ids
+    std::unordered_map<uint32_t, std::vector<uint32_t>> trigrams;    // 3 bytes of a name -> ascending name ids
+
+    static std::vector<uint32_t> trigramsOf(const std::string& text) {
+        std::vector<uint32_t> result;
+        for (size_t i = 0; i + 3 <= text.size(); i++) {
+            result.push_back(static_cast<uint32_t>(static_cast<unsigned char>(text[i])) << 16 |
+                             static_cast<uint32_t>(static_cast<unsigned char>(text[i + 1])) << 8 |
+                             static_cast<unsigned char>(text[i + 2]));
+        }
+        std::sort(result.begin(), result.end());
+        result.erase(std::unique(result.begin(), result.end()), result.end());
+        return result;
+    }
+
+    template <typename Matches>
+    std::vector<std::string> search(const std::string& text, size_t limit, const Matches& matches) const {
+        std::vector<std::string> result;
+        auto check = [&](uint32_t id) {
+            if (live[id] && matches(names[id])) result.push_back(names[id]);
+            return result.size() < limit;
+        };
+        if (text.size() < 3) {
+            for (uint32_t id = 0; id < names.size() && check(id); id++) {
+            }
+            return result;
+        }
+
+        std::vector<const std::vector<uint32_t>*> lists;
+        for (uint32_t trigram : trigramsOf(text)) {
+            auto it = trigrams.find(trigram);
+            if (it == trigrams.end()) return result;
+            lists.push_back(&it->second);
+        }
+        std::sort(lists.begin(), lists.end(), [](const auto* a, const auto* b) { return a->size() < b->size(); });
+        std::vector<uint32_t> candidates = *lists[0];
+        for (size_t i = 1; i < lists.size() && !candidates.empty(); i++) {
+            size_t kept = 0;
+            auto from = lists[i]->begin();
+            for (uint32_t id : candidates) {
+                from = std::lower_bound(from, lists[i]->end(), id);
+                if (from == lists[i]->end()) break;
+                if (*from == id) candidates[kept++] = id;
+            }
+            candidates.resize(kept);
+        }
+        for (size_t i = 0; i < candidates.size() && check(candidates[i]); i++) {
+        }
+        return result;
+    }
+};
+
+#endif
@@ -0,0 +1,47 @@
+// Worker pool shared by the retrieval programs of this repository:
+//
+//   #include "../common/parallel_for.h"
+//   parallelFor(files.size(), threads, [&](size_t i) { ... });
+#ifndef IR_COMMON_PARALLEL_FOR_H
+#define IR_COMMON_PARALLEL_FOR_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Runs task(0) ... task(count - 1) on up to `threads` workers. Idle workers keep
+// taking the next unclaimed task, so a few large files cannot stall the rest.
+// If a task throws, no further tasks are started and the first exception is
+// rethrown once the running ones have finished.
+inline void parallelFor(size_t count, unsigned threads, const std::function<void(size_t)>& task) {
+    if (threads <= 1 || count <= 1) {
+        for (size_t i = 0; i < count; i++) task(i);
+        return;
+    }
+    std::atomic<size_t> next{0};
+    std::exception_ptr failure;
+    std::mutex failureLock;
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < std::min<size_t>(threads, count); t++) {
+        workers.emplace_back([&]() {
+            for (size_t i = next++; i < count; i = next++) {
+                try {
+                    task(i);
+                } catch (...) {
+                    std::lock_guard<std::mutex> guard(failureLock);
+                    if (!failure) failure = std::current_exception();
+                    next = count;
+                }
+            }
+        });
+    }
+    for (auto& worker : workers) worker.join();
+    if (failure) std::rethrow_exception(failure);
+}
+
+#endif
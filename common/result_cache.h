@@ -0,0 +1,89 @@
+// Ranked-result cache shared by the retrieval programs of this repository:
+//
+//   #include "../common/result_cache.h"
+//   ResultCache<double> cache(16 << 20);
+#ifndef IR_COMMON_RESULT_CACHE_H
+#define IR_COMMON_RESULT_CACHE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Bounded LRU cache of ranked results (document name and score) keyed by a
+// normalized query, safe to share between threads. Each entry records the
+// index generation it was computed at; looking it up at any other generation
+// counts as a miss and drops it, so an update never lets a stale ranking
+// through. Callers whose index never changes leave the generation at 0.
+// Entries are evicted least recently used first once their estimated size
+// exceeds capacityBytes.
+template <typename Score>
+class ResultCache {
+public:
+    using Results = std::vector<std::pair<std::string, Score>>;
+
+    explicit ResultCache(size_t capacityBytes) : capacityBytes(capacityBytes) {}
+
+    bool lookup(const std::string& key, Results& results, uint64_t generation = 0) {
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = index.find(key);
+        if (it != index.end() && it->second->generation != generation) {
+            erase(it);
+            it = index.end();
+        }
+        if (it == index.end()) {
+            misses++;
+            return false;
+        }
+        entries.splice(entries.begin(), entries, it->second);
+        results = it->second->results;
+        hits++;
+        return true;
+    }
+
+    void insert(const std::string& key, Results results, uint64_t generation = 0) {
+        size_t bytes = sizeof(Entry) + 2 * key.size() + results.size() * sizeof(typename Results::value_type);
+        for (const auto& result : results) bytes += result.first.size();
+        if (bytes > capacityBytes) return;
+
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = index.find(key);
+        if (it != index.end()) erase(it);
+        entries.push_front({key, generation, std::move(results), bytes});
+        index[key] = entries.begin();
+        usedBytes += bytes;
+        while (usedBytes > capacityBytes) erase(index.find(entries.back().key));
+    }
+
+    uint64_t hitCount() const { return hits; }
+    uint64_t missCount() const { return misses; }
+
+private:
+    struct Entry {
+        std::string key;
+        uint64_t generation;
+        Results results;
+        size_t bytes;
+    };
+    using Position = typename std::unordered_map<std::string, typename std::list<Entry>::iterator>::iterator;
+
+    size_t capacityBytes;
+    size_t usedBytes = 0;
+    std::list<Entry> entries;  // most recently used first
+    std::unordered_map<std::string, typename std::list<Entry>::iterator> index;
+    std::mutex lock;
+    std::atomic<uint64_t> hits{0}, misses{0};
+
+    void erase(Position it) {
+        usedBytes -= it->second->bytes;
+        entries.erase(it->second);
+        index.erase(it);
+    }
+};
+
+#endif
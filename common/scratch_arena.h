@@ -0,0 +1,33 @@
+// Per-thread scratch memory shared by the retrieval programs of this repository:
+//
+//   #include "../common/scratch_arena.h"
+//   ScratchArena arena;
+//   std::pmr::unordered_map<std::string_view, uint32_t> counts(arena.get());
+#ifndef IR_COMMON_SCRATCH_ARENA_H
+#define IR_COMMON_SCRATCH_ARENA_H
+
+#include <cstddef>
+#include <memory_resource>
+#include <vector>
+
+// Per-thread scratch memory for tables that only live for one document or one
+// query. An arena carves its allocations out of the thread's buffer and gives
+// them all back at once when it goes out of scope, so building and dropping a
+// hash table of thousands of nodes costs no calls into the heap; only tables that
+// outgrow the buffer spill over to it. At most one arena per thread may be alive.
+class ScratchArena {
+public:
+    ScratchArena() : resource(buffer().data(), buffer().size()) {}
+
+    std::pmr::memory_resource* get() { return &resource; }
+
+private:
+    static std::vector<std::byte>& buffer() {
+        static thread_local std::vector<std::byte> storage(1 << 20);
+        return storage;
+    }
+
+    std::pmr::monotonic_buffer_resource resource;
+};
+
+#endif
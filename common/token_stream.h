@@ -0,0 +1,390 @@
+// Tokenizer shared by the retrieval programs of this repository, with the
+// mapped file and chunked reader they feed it from. Each program includes it
+// relative to its own folder and picks the rule it splits text by:
+//
+//   #include "../common/token_stream.h"
+//   using TokenStream = BasicTokenStream<TokenRule::Whitespace>;
+//   using ChunkedTokens = BasicChunkedTokens<TokenRule::Whitespace>;
+#ifndef IR_COMMON_TOKEN_STREAM_H
+#define IR_COMMON_TOKEN_STREAM_H
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// What a token is; tokens are always lowercased (ASCII letters only)
+enum class TokenRule {
+    Whitespace,    // whitespace-separated words (assignment1, ass_5)
+    Alphanumeric,  // maximal runs of letters and digits (assignment_3)
+    Squeezed,      // whitespace-separated words with every non-alphanumeric byte
+                   // dropped, skipping words left empty (Assignment2)
+};
+
+// The whitespace of the C locale: space, \t, \n, \v, \f and \r
+inline bool isTokenSpace(char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+inline bool isTokenAlnum(char c) {
+    unsigned char lower = static_cast<unsigned char>(c) | 0x20;
+    return (c >= '0' && c <= '9') || (lower >= 'a' && lower <= 'z');
+}
+
+// True for the bytes no token of the rule contains, so text can be cut after one
+template <TokenRule Rule>
+bool isTokenBoundary(char c) {
+    return Rule == TokenRule::Alphanumeric ? !isTokenAlnum(c) : isTokenSpace(c);
+}
+
+// Splits a buffer into tokens without allocating. The buffer is lowercased in
+// place one block at a time while its bytes are classified with SIMD compares
+// (AVX2 or SSE2 when the compiler targets them, scalar otherwise); next()
+// returns views into the buffer, which must outlive them.
+template <TokenRule Rule>
+class BasicTokenStream {
+public:
+    BasicTokenStream(char* data, size_t size) : data(data), size(size) {}
+
+    bool next(std::string_view& token) {
+        while (seek(true)) {
+            size_t start = pos;
+            seek(false);
+            if constexpr (Rule != TokenRule::Squeezed) {
+                token = std::string_view(data + start, pos - start);
+                return true;
+            } else {
+                // Dropped bytes are squeezed out of the word in place
+                size_t length = 0;
+                for (size_t i = start; i < pos; i++) {
+                    if (isTokenAlnum(data[i])) data[start + length++] = data[i];
+                }
+                if (length > 0) {
+                    token = std::string_view(data + start, length);
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+private:
+#if defined(__AVX2__)
+    static constexpr size_t BLOCK = 32;
+    static constexpr uint32_t BLOCK_BITS = 0xFFFFFFFFu;
+#else
+    static constexpr size_t BLOCK = 16;
+    static constexpr uint32_t BLOCK_BITS = 0xFFFFu;
+#endif
+    char* data;
+    size_t size;
+    size_t pos = 0;
+    size_t maskBase = SIZE_MAX;
+    uint32_t mask = 0;  // bit i is set when data[maskBase + i] is part of a token
+
+    // Moves pos to the next byte that is (or is not) part of a token
+    bool seek(bool inToken) {
+        while (pos < size) {
+            size_t base = pos & ~(BLOCK - 1);
+            if (base != maskBase) {
+                mask = classify(data + base, std::min(BLOCK, size - base));
+                maskBase = base;
+            }
+            uint32_t bits = ((inToken ? mask : ~mask) & BLOCK_BITS) >> (pos - base);
+            if (bits != 0) {
+                pos += __builtin_ctz(bits);
+                return true;
+            }
+            pos = base + BLOCK;
+        }
+        pos = size;
+        return false;
+    }
+
+    // Lowercases n <= BLOCK bytes in place and returns the mask of the bytes
+    // tokens are made of: alphanumerics for Alphanumeric, non-spaces otherwise
+    static uint32_t classify(char* p, size_t n) {
+#if defined(__AVX2__)
+        if (n == BLOCK) {
+            __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+            __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(x, _mm256_set1_epi8('A' - 1)),
+                                             _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), x));
+            x = _mm256_add_epi8(x, _mm256_and_si256(upper, _mm256_set1_epi8(0x20)));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), x);
+            if constexpr (Rule == TokenRule::Alphanumeric) {
+                __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(x, _mm256_set1_epi8('0' - 1)),
+                                                 _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), x));
+                __m256i letter = _mm256_and_si256(_mm256_cmpgt_epi8(x, _mm256_set1_epi8('a' - 1)),
+                                                  _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), x));
+                return static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_or_si256(digit, letter)));
+            } else {
+                __m256i space = _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')),
+                                                _mm256_and_si256(_mm256_cmpgt_epi8(x, _mm256_set1_epi8('\t' - 1)),
+                                                                 _mm256_cmpgt_epi8(_mm256_set1_epi8('\r' + 1), x)));
+                return ~static_cast<uint32_t>(_mm256_movemask_epi8(space));
+            }
+        }
+#elif defined(__SSE2__)
+        if (n == BLOCK) {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8('A' - 1)),
+                                          _mm_cmplt_epi8(x, _mm_set1_epi8('Z' + 1)));
+            x = _mm_add_epi8(x, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(p), x);
+            if constexpr (Rule == TokenRule::Alphanumeric) {
+                __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8('0' - 1)),
+                                              _mm_cmplt_epi8(x, _mm_set1_epi8('9' + 1)));
+                __m128i letter = _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8('a' - 1)),
+                                               _mm_cmplt_epi8(x, _mm_set1_epi8('z' + 1)));
+                return static_cast<uint32_t>(_mm_movemask_epi8(_mm_or_si128(digit, letter)));
+            } else {
+                __m128i space = _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(' ')),
+                                             _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8('\t' - 1)),
+                                                           _mm_cmplt_epi8(x, _mm_set1_epi8('\r' + 1))));
+                return ~static_cast<uint32_t>(_mm_movemask_epi8(space)) & BLOCK_BITS;
+            }
+        }
+#endif
+        uint32_t bits = 0;
+        for (size_t i = 0; i < n; i++) {
+            if (p[i] >= 'A' && p[i] <= 'Z') p[i] = static_cast<char>(p[i] + 32);
+            bool inToken = Rule == TokenRule::Alphanumeric ? isTokenAlnum(p[i]) : !isTokenSpace(p[i]);
+            if (inToken) bits |= 1u << i;
+        }
+        return bits;
+    }
+};
+
+// Read-only view of a whole file. On POSIX systems the file is mapped, so its
+// bytes stay in the page cache, where the kernel can drop and re-read them,
+// instead of being copied into the process. Files that cannot be mapped (or
+// any file on Windows) are read into memory instead.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path) {
+#ifndef _WIN32
+        if (map(path)) return;
+#endif
+        std::ifstream file(path, std::ios::binary);
+        if (!file) return;
+        opened = true;
+        copy.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        bytes = copy.data();
+        length = copy.size();
+    }
+
+    // Views a file that is already open for reading, such as a temporary file
+    // that has been unlinked; the file stays the caller's to close
+    explicit MappedFile(std::FILE* file) {
+        if (file == nullptr || std::fflush(file) != 0) return;
+#ifndef _WIN32
+        if (mapDescriptor(fileno(file))) return;
+#endif
+        std::rewind(file);
+        std::string contents;
+        char chunk[1 << 16];
+        for (size_t count; (count = std::fread(chunk, 1, sizeof(chunk), file)) > 0;) contents.append(chunk, count);
+        if (std::ferror(file)) return;
+        opened = true;
+        copy.swap(contents);
+        bytes = copy.data();
+        length = copy.size();
+    }
+
+    MappedFile(MappedFile&& other) noexcept { swap(other); }
+    MappedFile& operator=(MappedFile&& other) noexcept {
+        swap(other);
+        return *this;
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+#ifndef _WIN32
+        if (mapped) munmap(const_cast<char*>(bytes), length);
+#endif
+    }
+
+    bool isOpen() const { return opened; }
+    std::string_view view() const { return std::string_view(bytes, length); }
+    size_t size() const { return length; }
+
+private:
+    bool opened = false;
+    bool mapped = false;
+    const char* bytes = nullptr;
+    size_t length = 0;
+    std::string copy;  // the contents when the file is not mapped
+
+#ifndef _WIN32
+    // Returns false only when a regular file could not be mapped
+    bool map(const std::string& path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) return true;
+        bool done = mapDescriptor(fd);
+        close(fd);
+        return done;
+    }
+
+    bool mapDescriptor(int fd) {
+        struct stat info;
+        bool done = true;
+        if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode)) {
+            opened = true;
+            if (info.st_size > 0) {
+                void* mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (mapping == MAP_FAILED) {
+                    opened = false;
+                    done = false;
+                } else {
+                    mapped = true;
+                    bytes = static_cast<const char*>(mapping);
+                    length = static_cast<size_t>(info.st_size);
+                }
+            }
+        }
+        return done;
+    }
+#endif
+
+    void swap(MappedFile& other) {
+        std::swap(opened, other.opened);
+        std::swap(mapped, other.mapped);
+        std::swap(bytes, other.bytes);
+        std::swap(length, other.length);
+        copy.swap(other.copy);
+        if (!mapped && opened) bytes = copy.data();
+        if (!other.mapped && other.opened) other.bytes = other.copy.data();
+    }
+};
+
+// Tokenizes read-only text one chunk at a time, so a document of any size is
+// indexed with about one chunk of memory. BasicTokenStream rewrites its input,
+// so each chunk is copied into a reusable buffer; it ends just after a
+// boundary byte of the rule so that no token is cut in two, growing past
+// chunkSize only to finish a longer token. The kernel is asked to read the
+// next chunk ahead while this one is tokenized. Tokens view the buffer and are
+// only valid until next() moves on to another chunk.
+template <TokenRule Rule>
+class BasicChunkedTokens {
+public:
+    explicit BasicChunkedTokens(std::string_view text, size_t chunkSize = 1 << 20) : text(text), chunkSize(chunkSize) {}
+
+    bool next(std::string_view& token) {
+        while (!stream.next(token)) {
+            if (offset == text.size()) return false;
+            size_t end = std::min(text.size(), offset + chunkSize);
+            if (end < text.size()) {
+                size_t cut = end;
+                while (cut > offset && !isTokenBoundary<Rule>(text[cut - 1])) cut--;
+                if (cut > offset) end = cut;
+                else while (end < text.size() && !isTokenBoundary<Rule>(text[end])) end++;
+                prefetch(end);
+            }
+            buffer.assign(text.data() + offset, end - offset);
+            chunkStart = offset;
+            offset = end;
+            stream = BasicTokenStream<Rule>(buffer.data(), buffer.size());
+        }
+        return true;
+    }
+
+    // Offset in the text of the word that a token from next() came from
+    size_t offsetOf(std::string_view token) const {
+        return chunkStart + (token.data() - buffer.data());
+    }
+
+private:
+    std::string_view text;
+    size_t chunkSize;
+    size_t offset = 0;
+    size_t chunkStart = 0;
+    std::string buffer;
+    BasicTokenStream<Rule> stream{nullptr, 0};
+
+    void prefetch(size_t from) {
+#ifndef _WIN32
+        static const uintptr_t pageMask = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE)) - 1;
+        uintptr_t first = reinterpret_cast<uintptr_t>(text.data() + from) & ~pageMask;
+        uintptr_t last = reinterpret_cast<uintptr_t>(text.data() + std::min(text.size(), from + chunkSize));
+        madvise(reinterpret_cast<void*>(first), last - first, MADV_WILLNEED);
+#else
+        (void)from;
+#endif
+    }
+};
+
+// Straightforward version of each rule with <cctype>, kept to check and time
+// BasicTokenStream against
+template <TokenRule Rule>
+std::vector<std::string> referenceTokens(std::string_view text) {
+    std::vector<std::string> tokens;
+    std::string token;
+    for (char ch : text) {
+        unsigned char c = static_cast<unsigned char>(ch);
+        bool boundary = Rule == TokenRule::Alphanumeric ? !std::isalnum(c) : std::isspace(c) != 0;
+        if (boundary) {
+            if (!token.empty()) tokens.push_back(token);
+            token.clear();
+        } else if (Rule != TokenRule::Squeezed || std::isalnum(c)) {
+            token += static_cast<char>(std::tolower(c));
+        }
+    }
+    if (!token.empty()) tokens.push_back(token);
+    return tokens;
+}
+
+// --bench-tokenizer of every program: times referenceTokens against
+// BasicTokenStream on one file and checks that both produce the same tokens
+template <TokenRule Rule>
+void benchmarkTokenizer(const std::string& filePath) {
+    const int runs = 5;
+    std::ifstream file(filePath, std::ios::binary);
+    std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    std::vector<std::string> expected;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < runs; i++) expected = referenceTokens<Rule>(content);
+    double referenceSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / runs;
+
+    size_t tokens = 0;
+    bool same = true;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < runs; i++) {
+        std::string buffer = content;
+        BasicTokenStream<Rule> stream(buffer.data(), buffer.size());
+        std::string_view token;
+        tokens = 0;
+        while (stream.next(token)) {
+            if (i == 0) same = same && tokens < expected.size() && expected[tokens] == token;
+            tokens++;
+        }
+    }
+    double streamSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / runs;
+
+    std::cout << tokens << " tokens, " << (same && tokens == expected.size() ? "identical" : "DIFFERENT") << " output\n";
+    std::cout << "reference: " << content.size() / referenceSeconds / 1e9 << " GB/s\n";
+    std::cout << "TokenStream: " << content.size() / streamSeconds / 1e9 << " GB/s" << std::endl;
+}
+
+#endif
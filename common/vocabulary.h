@@ -0,0 +1,44 @@
+// Term lexicon shared by the retrieval programs of this repository:
+//
+//   #include "../common/vocabulary.h"
+//   Vocabulary vocabulary;
+//   uint32_t id = vocabulary.intern("retrieval");
+#ifndef IR_COMMON_VOCABULARY_H
+#define IR_COMMON_VOCABULARY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// Interns every distinct term once and hands out dense ids in first-seen order,
+// so the models key their structures by 32-bit ids instead of strings
+class Vocabulary {
+public:
+    static constexpr uint32_t NOT_FOUND = UINT32_MAX;
+
+    uint32_t intern(std::string_view term) {
+        auto it = ids.find(term);
+        if (it != ids.end()) return it->second;
+        terms.emplace_back(term);
+        uint32_t id = static_cast<uint32_t>(terms.size() - 1);
+        ids.emplace(terms.back(), id);  // the key views the deque entry, which never moves
+        return id;
+    }
+
+    uint32_t find(std::string_view term) const {
+        auto it = ids.find(term);
+        return it == ids.end() ? NOT_FOUND : it->second;
+    }
+
+    const std::string& term(uint32_t id) const { return terms[id]; }
+    size_t size() const { return terms.size(); }
+
+private:
+    std::deque<std::string> terms;
+    std::unordered_map<std::string_view, uint32_t> ids;
+};
+
+#endif
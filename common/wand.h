@@ -0,0 +1,104 @@
+// WAND top-k search shared by the ranked models of this repository. Each program
+// aliases a cursor over its own postings and score type:
+//
+//   #include "../common/wand.h"
+//   using TermCursor = BasicTermCursor<Posting, double>;
+#ifndef IR_COMMON_WAND_H
+#define IR_COMMON_WAND_H
+
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <utility>
+#include <vector>
+
+// Position of a query term in its postings list during a top-k search. Postings
+// are any struct with a `doc` field, in increasing doc order.
+template <typename Posting, typename Score>
+struct BasicTermCursor {
+    using Doc = decltype(Posting::doc);
+    static constexpr Doc END = std::numeric_limits<Doc>::max();  // doc() once the list is used up
+
+    const std::vector<Posting>* postings;
+    size_t position;
+    Score upperBound;  // largest score contribution the term can make to any document
+    Score weight;      // per-term weight the scorer uses, such as the term's idf
+
+    Doc doc() const { return position < postings->size() ? (*postings)[position].doc : END; }
+    const Posting& posting() const { return (*postings)[position]; }
+};
+
+// Document-at-a-time top-k search with WAND pruning. Cursors are kept ordered by
+// their current document; the pivot is the first cursor at which the summed
+// upper bounds could beat the k-th best score so far, and every document before
+// the pivot is skipped without being scored. A pivot document for which
+// skip(doc) holds (a tombstone, say) is stepped over before it is scored; any
+// other is scored by score(doc, matched) from the cursors positioned on it.
+// Returns up to k (doc, score) pairs, best first, ties broken by lower doc.
+template <typename Cursor, typename Scorer, typename Skip>
+auto wandTopK(std::vector<Cursor> cursors, size_t k, Scorer score, Skip skip) {
+    using Doc = typename Cursor::Doc;
+    using Result = std::pair<Doc, decltype(Cursor::upperBound)>;
+    auto better = [](const Result& a, const Result& b) {
+        return a.second != b.second ? a.second > b.second : a.first < b.first;
+    };
+    std::vector<Result> heap;  // worst of the current top k at the front
+    decltype(Cursor::upperBound) threshold = 0;
+    std::vector<const Cursor*> matched;
+
+    while (k > 0) {
+        std::sort(cursors.begin(), cursors.end(), [](const Cursor& a, const Cursor& b) { return a.doc() < b.doc(); });
+
+        size_t pivot = cursors.size();
+        decltype(Cursor::upperBound) bound = 0;
+        for (size_t i = 0; i < cursors.size() && cursors[i].doc() != Cursor::END; ++i) {
+            bound += cursors[i].upperBound;
+            if (bound > threshold) {
+                pivot = i;
+                break;
+            }
+        }
+        if (pivot == cursors.size()) break;
+
+        Doc pivotDoc = cursors[pivot].doc();
+        if (cursors[0].doc() == pivotDoc) {
+            if (skip(pivotDoc)) {
+                for (Cursor& cursor : cursors) {
+                    if (cursor.doc() == pivotDoc) ++cursor.position;
+                }
+                continue;
+            }
+            matched.clear();
+            for (const Cursor& cursor : cursors) {
+                if (cursor.doc() == pivotDoc) matched.push_back(&cursor);
+            }
+            Result candidate(pivotDoc, score(pivotDoc, matched));
+            for (Cursor& cursor : cursors) {
+                if (cursor.doc() == pivotDoc) ++cursor.position;
+            }
+
+            if (heap.size() < k) {
+                heap.push_back(candidate);
+                std::push_heap(heap.begin(), heap.end(), better);
+            } else if (better(candidate, heap.front())) {
+                std::pop_heap(heap.begin(), heap.end(), better);
+                heap.back() = candidate;
+                std::push_heap(heap.begin(), heap.end(), better);
+            }
+            if (heap.size() == k) threshold = heap.front().second;
+        } else {
+            // Nothing before pivotDoc can make it into the top k
+            for (size_t i = 0; i < pivot; ++i) {
+                const auto& list = *cursors[i].postings;
+                cursors[i].position = std::lower_bound(list.begin() + cursors[i].position, list.end(), pivotDoc,
+                                                       [](const auto& posting, Doc doc) { return posting.doc < doc; }) -
+                                      list.begin();
+            }
+        }
+    }
+
+    std::sort_heap(heap.begin(), heap.end(), better);
+    return heap;
+}
+
+#endif